@@ -11,3 +11,35 @@
 	#define ARDUINOMQTT_BUFSIZE 256
 	#endif
 #endif
+
+#ifndef HOMIELIB_INBOUND_TOPIC_MAX
+#define HOMIELIB_INBOUND_TOPIC_MAX 128
+#endif
+
+#ifndef HOMIELIB_INBOUND_PAYLOAD_MAX
+#define HOMIELIB_INBOUND_PAYLOAD_MAX 128
+#endif
+
+#ifndef HOMIELIB_POST_STRING_MAX
+#define HOMIELIB_POST_STRING_MAX 24
+#endif
+
+#ifndef HOMIELIB_POST_PAYLOAD_MAX
+#define HOMIELIB_POST_PAYLOAD_MAX 64
+#endif
+
+#ifndef HOMIELIB_CALLBACK_INLINE_SIZE
+#define HOMIELIB_CALLBACK_INLINE_SIZE (4*sizeof(void *))	//captures up to this size are stored inside the property
+#endif
+
+#ifndef HOMIELIB_INFLIGHT_MAX
+#define HOMIELIB_INFLIGHT_MAX 16	//QoS 1/2 publishes tracked until acknowledged
+#endif
+
+#ifndef HOMIELIB_INFLIGHT_TIMEOUT_MS
+#define HOMIELIB_INFLIGHT_TIMEOUT_MS 30000
+#endif
+
+#ifndef HOMIELIB_REFRESH_SLOTS
+#define HOMIELIB_REFRESH_SLOTS 32	//phases the refresh interval is divided into, see HomieDevice::ulRefreshInterval_ms
+#endif
@@ -0,0 +1,77 @@
+#include "HomieClient.h"
+
+#if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
+
+void HomieCoalescingClient::SetBufferSize(int iSize)
+{
+	delete [] pBuffer;
+	pBuffer=iSize>0?new uint8_t[iSize]:NULL;
+	this->iSize=pBuffer?iSize:0;
+	iLength=0;
+}
+
+bool HomieCoalescingClient::EndCoalesce()
+{
+	if(!iDepth || --iDepth) return true;
+	return Flush();
+}
+
+bool HomieCoalescingClient::Flush()
+{
+	if(!iLength) return true;
+
+	bool bComplete=WriteThrough(pBuffer,iLength)==iLength;
+	iLength=0;
+
+	if(!bComplete)
+	{
+		//the buffered publishes were already reported as sent, and part of a packet may be on the wire.
+		//reconnecting makes the device publish everything again. write through from now on
+		ulFlushFailures++;
+		SetBufferSize(0);
+		client.stop();
+	}
+
+	return bComplete;
+}
+
+size_t HomieCoalescingClient::WriteThrough(const uint8_t * buf, size_t size)
+{
+	size_t done=0;
+	while(done<size)
+	{
+		size_t ret=client.write(buf+done,size-done);
+		if(!ret) break;		//the socket's own timeout ran out
+		done+=ret;
+		ulWrites++;
+	}
+
+	ulBytes+=done;
+	return done;
+}
+
+size_t HomieCoalescingClient::write(const uint8_t * buf, size_t size)
+{
+	ulWriteCalls++;
+
+	if(!iDepth || !pBuffer)
+	{
+		return WriteThrough(buf,size);
+	}
+
+	if(iLength+size>iSize)
+	{
+		if(!Flush()) return 0;	//this publish fails like it would have without coalescing
+	}
+
+	if(size>=iSize)
+	{
+		return WriteThrough(buf,size);
+	}
+
+	memcpy(pBuffer+iLength,buf,size);
+	iLength+=size;
+	return size;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+#include "Config.h"
+
+#if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
+
+#if defined(ARDUINO_ARCH_ESP8266)
+#include <ESP8266WiFi.h>
+#else
+#include "WiFi.h"
+#endif
+
+//sits between the MQTT library and the socket. while coalescing, small writes are collected into
+//chunks of up to the buffer size. anything that reads flushes first, so a publish waiting for its ack still works.
+//that also means ArduinoMQTT, which waits for the ack of every QoS 1/2 publish, sends each of those on its own.
+//only its QoS 0 publishes are gathered. PubSubClient publishes at QoS 0 only, so all of them are.
+//a flush that fails leaves the MQTT stream unusable, so the connection is dropped and coalescing turned off.
+class HomieCoalescingClient : public Client
+{
+public:
+	HomieCoalescingClient(Client & client) : client(client) {}
+	~HomieCoalescingClient() { delete [] pBuffer; }
+
+	void SetBufferSize(int iSize);	//0 writes straight through
+	void BeginCoalesce() { iDepth++; }
+	bool EndCoalesce();		//flushes when the outermost phase ends. false if that failed
+	bool Flush();
+
+	uint32_t GetWrites() { return ulWrites; }			//writes that reached the socket
+	uint32_t GetWriteCalls() { return ulWriteCalls; }	//writes made by the MQTT library
+	uint32_t GetBytes() { return ulBytes; }
+	uint32_t GetFlushFailures() { return ulFlushFailures; }
+
+	int connect(IPAddress ip, uint16_t port) override { Discard(); return client.connect(ip,port); }
+	int connect(const char * host, uint16_t port) override { Discard(); return client.connect(host,port); }
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR>=2
+	int connect(IPAddress ip, uint16_t port, int32_t timeout) override { Discard(); return client.connect(ip,port,timeout); }
+	int connect(const char * host, uint16_t port, int32_t timeout) override { Discard(); return client.connect(host,port,timeout); }
+#endif
+	size_t write(uint8_t b) override { return write(&b,1); }
+	size_t write(const uint8_t * buf, size_t size) override;
+	int available() override { Flush(); return client.available(); }
+	int read() override { Flush(); return client.read(); }
+	int read(uint8_t * buf, size_t size) override { Flush(); return client.read(buf,size); }
+	int peek() override { Flush(); return client.peek(); }
+	void flush() override { Flush(); client.flush(); }
+	void stop() override { Discard(); client.stop(); }
+	uint8_t connected() override { return client.connected(); }
+	operator bool() override { return (bool) client; }
+
+private:
+	void Discard() { iLength=0; }
+	size_t WriteThrough(const uint8_t * buf, size_t size);	//retries short writes, returns what got through
+
+	Client & client;
+	int iDepth=0;
+	uint8_t * pBuffer=NULL;
+	size_t iSize=0;
+	size_t iLength=0;
+
+	uint32_t ulWrites=0;
+	uint32_t ulWriteCalls=0;
+	uint32_t ulBytes=0;
+	uint32_t ulFlushFailures=0;
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include "HomieColor.h"
+
+//fixed point color component: digits with an optional fraction, kept to iDecimals decimals. no fraction at all if iDecimals is 0.
+//advances past the comma that must follow unless bLast.
+static bool HomieParseColorComponent(const char * & in, int iDecimals, int32_t max, bool bLast, int32_t & value)
+{
+	int32_t accumulator=0;
+	int digits=0;
+
+	while(*in==' ') in++;
+
+	while((unsigned) (*in-'0')<=9)
+	{
+		accumulator=accumulator*10+(*in++-'0');
+		if(++digits>6) return false;
+	}
+
+	int decimals=0;
+	if(*in=='.')
+	{
+		if(!iDecimals) return false;
+		in++;
+		while((unsigned) (*in-'0')<=9)
+		{
+			if(decimals<iDecimals)
+			{
+				accumulator=accumulator*10+(*in-'0');
+				decimals++;
+			}
+			in++;
+		}
+	}
+
+	if(!digits) return false;
+
+	while(decimals<iDecimals)
+	{
+		accumulator*=10;
+		decimals++;
+	}
+
+	while(*in==' ') in++;
+	if(bLast)
+	{
+		if(*in) return false;
+	}
+	else
+	{
+		if(*in!=',') return false;
+		in++;
+	}
+
+	if(accumulator>max) return false;
+
+	value=accumulator;
+	return true;
+}
+
+bool HomieParseRGB(const char * in, uint32_t & rgb)
+{
+	int32_t r, g, b;
+
+	if(HomieParseColorComponent(in, 0, 255, false, r) && HomieParseColorComponent(in, 0, 255, false, g) && HomieParseColorComponent(in, 0, 255, true, b))
+	{
+		rgb=(r<<16) + (g<<8) + (b<<0);
+		return true;
+	}
+	return false;
+}
+
+bool HomieParseHSV(const char * in, uint32_t & rgb)
+{
+	int32_t h, s, v;	//tenths of a degree, tenths of a percent
+
+	if(HomieParseColorComponent(in, 1, 3600, false, h) && HomieParseColorComponent(in, 1, 1000, false, s) && HomieParseColorComponent(in, 1, 1000, true, v))
+	{
+		uint32_t hsv=HomiePackHSV((h*65536+1800)/3600, (s*255+500)/1000, (v*255+500)/1000);
+		HomieHSVtoRGB(&hsv, &rgb, 1);
+		return true;
+	}
+
+	return false;
+}
+
+static inline uint32_t HomieScale8(uint32_t a, uint32_t b)	//a*b/255, rounded
+{
+	uint32_t x=a*b+128;
+	return (x+(x>>8))>>8;
+}
+
+void HomieHSVtoRGB(const uint32_t * pHSV, uint32_t * pRGB, size_t count)
+{
+	//integer only and branch free so the compiler can vectorize it where it's able to
+	for(size_t i=0;i<count;i++)
+	{
+		uint32_t hsv=pHSV[i];
+		uint32_t h6=(hsv>>16)*6;
+		uint32_t sector=h6>>16;				//0-5, 6 only for h=65536 which doesn't fit
+		uint32_t frac=(h6>>8) & 0xFF;
+		uint32_t s=(hsv>>8) & 0xFF;
+		uint32_t v=hsv & 0xFF;
+
+		uint32_t c=HomieScale8(v,s);
+		uint32_t m=v-c;
+		uint32_t rise=m+HomieScale8(c,frac);
+		uint32_t fall=m+HomieScale8(c,255-frac);
+		uint32_t top=v;
+
+		uint32_t r=(sector==0 || sector==5)?top:(sector==1?fall:(sector==4?rise:m));
+		uint32_t g=(sector==1 || sector==2)?top:(sector==0?rise:(sector==3?fall:m));
+		uint32_t b=(sector==3 || sector==4)?top:(sector==2?rise:(sector==5?fall:m));
+
+		pRGB[i]=(r<<16) | (g<<8) | b;
+	}
+}
+
+uint32_t HomieRGBtoHSV(uint32_t rgb)
+{
+	int32_t r=(rgb>>16) & 0xFF;
+	int32_t g=(rgb>>8) & 0xFF;
+	int32_t b=rgb & 0xFF;
+
+	int32_t max=r>g?(r>b?r:b):(g>b?g:b);
+	int32_t min=r<g?(r<b?r:b):(g<b?g:b);
+	int32_t delta=max-min;
+
+	if(!delta) return HomiePackHSV(0,0,max);
+
+	int32_t h;	//in 1/6th of the circle, scaled by 65536
+	if(max==r) h=((g-b)*65536)/delta;
+	else if(max==g) h=2*65536+((b-r)*65536)/delta;
+	else h=4*65536+((r-g)*65536)/delta;
+	if(h<0) h+=6*65536;
+
+	return HomiePackHSV((uint32_t) h/6, (delta*255+max/2)/max, max);
+}
+
+//appends value/10 with its decimal, if any, and a separator. false if it doesn't fit
+static bool HomieAppendTenths(char * & p, char * pEnd, uint32_t tenths, char separator)
+{
+	char szTemp[12];
+	int count=0;
+	uint32_t whole=tenths/10;
+	if(tenths % 10)
+	{
+		szTemp[count++]='0'+(char) (tenths % 10);
+		szTemp[count++]='.';
+	}
+	do
+	{
+		szTemp[count++]='0'+(char) (whole % 10);
+		whole/=10;
+	} while(whole);
+
+	if(pEnd-p<=count+(separator?1:0)) return false;
+	while(count) *p++=szTemp[--count];
+	if(separator) *p++=separator;
+	*p=0;
+	return true;
+}
+
+int HomieFormatRGB(char * szOut, size_t size, uint32_t rgb)
+{
+	char * p=szOut;
+	char * pEnd=szOut+size;
+	if(HomieAppendTenths(p, pEnd, ((rgb>>16) & 0xFF)*10, ',') && HomieAppendTenths(p, pEnd, ((rgb>>8) & 0xFF)*10, ',') && HomieAppendTenths(p, pEnd, (rgb & 0xFF)*10, 0))
+	{
+		return (int) (p-szOut);
+	}
+	return -1;
+}
+
+int HomieFormatHSV(char * szOut, size_t size, uint32_t hsv)
+{
+	char * p=szOut;
+	char * pEnd=szOut+size;
+	if(HomieAppendTenths(p, pEnd, ((hsv>>16)*3600+32768)>>16, ',') && HomieAppendTenths(p, pEnd, (((hsv>>8) & 0xFF)*1000+127)/255, ',') && HomieAppendTenths(p, pEnd, ((hsv & 0xFF)*1000+127)/255, 0))
+	{
+		return (int) (p-szOut);
+	}
+	return -1;
+}
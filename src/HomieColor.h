@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+//color conversion in fixed point, no float and no heap allocation
+
+bool HomieParseRGB(const char * in, uint32_t & rgb);	//"r,g,b" 0-255
+bool HomieParseHSV(const char * in, uint32_t & rgb);	//"h,s,v" 0-360,0-100,0-100
+
+//packed hsv: hue in the upper 16 bits (65536 is a full circle), saturation and value 0-255 below
+inline uint32_t HomiePackHSV(uint32_t h, uint32_t s, uint32_t v) { return ((h & 0xFFFF)<<16) | ((s & 0xFF)<<8) | (v & 0xFF); }
+void HomieHSVtoRGB(const uint32_t * pHSV, uint32_t * pRGB, size_t count);	//integer math, for whole pixel arrays
+uint32_t HomieRGBtoHSV(uint32_t rgb);
+
+int HomieFormatRGB(char * szOut, size_t size, uint32_t rgb);	//"r,g,b". returns length, -1 if it doesn't fit
+int HomieFormatHSV(char * szOut, size_t size, uint32_t hsv);	//"h,s,v" in tenths, no trailing ".0"
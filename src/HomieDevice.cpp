@@ -1,5 +1,6 @@
 #include "HomieDevice.h"
 #include "HomieNode.h"
+#include <algorithm>
 void HomieLibDebugPrint(const char * szText);
 
 
@@ -13,12 +14,6 @@ void HomieLibDebugPrint(const char * szText);
 
 static std::vector<HomieDebugPrintCallback> vecDebugPrint;
 
-const int ipub_qos=1;
-#if defined(USE_PUBSUBCLIENT)
-const int sub_qos=1;
-#else
-const int sub_qos=2;
-#endif
 
 void HomieLibRegisterDebugPrintCallback(HomieDebugPrintCallback cb)
 {
@@ -73,7 +68,7 @@ HomieDevice::HomieDevice()
 #if defined(USE_ARDUINOMQTT)
 	pMQTT=new MQTTClient(ARDUINOMQTT_BUFSIZE);
 #elif defined(USE_PUBSUBCLIENT)
-	pMQTT=new PubSubClient(net);
+	pMQTT=new PubSubClient(netCoalesce);
 #endif
 }
 
@@ -104,40 +99,49 @@ void TaskConnect(void * parameter)
 
 void HomieDevice::TaskConnect()
 {
-	while(1)
+	if(bDoConnect)
 	{
-		vTaskDelay(10);
+		csprintf("DoConnect!\n");
+		bDoConnect=false;
 
-		if(bDoConnect)
+		if(ConnectSession(false))
+		{
+			csprintf("Success\n");
+			onConnect(false);
+		}
+		else
 		{
-			csprintf("DoConnect!\n");
-			bDoConnect=false;
+			csprintf("Failure!\n");
+			onDisconnect(0);
+		}
 
-			int ret=pMQTT->connect(strClientID.c_str(), strMqttUserName.c_str(), strMqttPassword.c_str(), szWillTopic, 1, 1, "lost");
-			if(ret)
-			{
-				csprintf("Success\n");
-				onConnect(false);
-			}
-			else
-			{
-				bConnecting=false;
-				csprintf("Failure!\n");
-			}
+	}
+}
 
-		}
+bool HomieDevice::StartConnectTask()
+{
+	if(workerConnect.IsRunning()) return true;
 
+	if(workerConnect.Start("TaskHomieConnect", iConnectTaskStackSize, ::TaskConnect, this)) return true;
 
-	}
+	csprintf("Couldn't create the connect task, connecting from Loop\n");
+	return false;
 }
 
 #endif
 
+static uint32_t HomieRandom()
+{
+	return (uint32_t) random(0x7FFFFFFF);
+}
+
 void HomieDevice::Init()
 {
 	if(bInitialized) return;
 
 	strTopic=String("homie/")+strID;
+
+	ulPhaseSeed=HomiePhaseSeed(strID.c_str(),WiFi.macAddress().c_str());
 	strcpy(szWillTopic,String(strTopic+"/$state").c_str());
 
 	if(!vecNode.size())
@@ -158,11 +162,33 @@ void HomieDevice::Init()
 
 	}
 
+	vecLimited.clear();
+	vecStream.clear();
+	vecAllProperties.clear();
 	for(size_t a=0;a<vecNode.size();a++)
 	{
 		vecNode[a]->Init();
+
+		for(size_t b=0;b<vecNode[a]->vecProperty.size();b++)
+		{
+			HomieProperty * pProp=vecNode[a]->vecProperty[b];
+			vecAllProperties.push_back(pProp);
+			if(pProp->pLimit) vecLimited.push_back(pProp);
+			if(pProp->GetIsStream()) vecStream.push_back((HomieStreamProperty *) pProp);
+		}
 	}
 
+	BuildRoutes();
+	BuildRefreshSlots();
+	BuildInitialOrder();
+
+	vecPublishQueue.resize(iPublishQueueSize>0?iPublishQueueSize:0);
+	ringIncoming.Init(iIncomingQueueSize);
+	ringPost.Init(iPostQueueSize);
+	ringPostDirect.Init(iPostDirectQueueSize);
+	iPublishQueueHead=0;
+	iPublishQueueCount=0;
+
 
 #if defined(USE_PANGOLIN) | defined(USE_ASYNCMQTTCLIENT)
 
@@ -171,6 +197,9 @@ void HomieDevice::Init()
 	mqtt.onConnect(std::bind(&HomieDevice::onConnect, this, std::placeholders::_1));
 	mqtt.onDisconnect(std::bind(&HomieDevice::onDisconnect, this, std::placeholders::_1));
 	mqtt.onMessage(std::bind(&HomieDevice::onMqttMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5, std::placeholders::_6));
+#if defined(USE_ASYNCMQTTCLIENT)
+	mqtt.onPublish(std::bind(&HomieDevice::onPublishAck, this, std::placeholders::_1));
+#endif
 
 #elif defined(USE_ARDUINOMQTT)
 
@@ -188,6 +217,13 @@ void HomieDevice::Init()
 			});
 #endif
 
+#if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
+	netCoalesce.SetBufferSize(iCoalesceBufferSize);
+#endif
+#if defined(USE_ARDUINOMQTT)
+	if(iCoalesceBufferSize && qosAttributes && qosValues) csprintf("Coalescing only gathers QoS 0 publishes on ArduinoMQTT, set qosAttributes or qosValues to 0\n");
+#endif
+
 #if defined(USE_PANGOLIN)
 	mqtt.onError(PangoError);
 #endif
@@ -206,23 +242,27 @@ void HomieDevice::Init()
 	strClientID += szMacString;
 
 #ifdef HOMIELIB_CONNECT_ASYNC
-	if(!bInitialized)
-	{
-		xTaskCreate(
-		  ::TaskConnect, /* Function to implement the task */
-		  "TaskHomieConnect", /* Name of the task */
-		  10000,  /* Stack size in words */
-		  this,  /* Task input parameter */
-		  1,  /* Priority of the task */
-		  &hTaskConnect /* Task handle. */
-		  );
-	}
+	StartConnectTask();
 #endif
 
 
 	bInitialized=true;
 }
 
+#if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
+bool HomieDevice::ConnectSession(bool bSocketOpen)
+{
+#if defined(USE_ARDUINOMQTT)
+	pMQTT->setTimeout(ulConnectStepTimeout_ms);
+	return pMQTT->connect(strClientID.c_str(), strMqttUserName.c_str(), strMqttPassword.c_str(), bSocketOpen);
+#elif defined(USE_PUBSUBCLIENT)
+	(void)(bSocketOpen);	//PubSubClient skips the socket connect by itself when it's already open
+	pMQTT->setSocketTimeout((ulConnectStepTimeout_ms+999)/1000);
+	return pMQTT->connect(strClientID.c_str(), strMqttUserName.c_str(), strMqttPassword.c_str(), szWillTopic, 1, 1, "lost");
+#endif
+}
+#endif
+
 void HomieDevice::DoDisconnect()
 {
 /*#if defined(ARDUINO_ARCH_ESP32)
@@ -237,9 +277,13 @@ void HomieDevice::DoDisconnect()
 
 void HomieDevice::Quit()
 {
-	Publish(String(strTopic+"/$state").c_str(), 1, true, "disconnected");
+	Publish(String(strTopic+"/$state").c_str(), qosAttributes, true, "disconnected");
 	DoDisconnect();
 	bInitialized=false;
+
+#ifdef HOMIELIB_CONNECT_ASYNC
+	workerConnect.Stop();	//lets a connect in progress finish, it's bounded by ulConnectStepTimeout_ms
+#endif
 }
 
 bool HomieDevice::IsConnected()
@@ -259,20 +303,155 @@ bool HomieDevice::IsReady()
 
 int iWiFiRSSI=0;
 
-void HomieDevice::Loop()
+static uint32_t ulFreeHeap=0xFFFFFFF;
+#if defined(ARDUINO_ARCH_ESP8266)
+static uint16_t ulFreeHeapContig=0xFFFF;
+static uint8_t uHeapFrag=0;
+#else
+static uint32_t ulFreeHeapContig=0xFFFFFFF;
+#endif
+
+unsigned long HomieDevice::Loop()
+{
+	if(!bInitialized) return iMainLoopInterval_ms;
+
+	if(!bWake && !HasImmediateWork() && (int32_t) (millis()-ulNextLoop)<0)
+	{
+		return ulNextLoop-millis();
+	}
+
+	bWake=false;
+
+	ulLoopStart_us=micros();
+	DoLoop();
+
+	unsigned long ulDuration_us=micros()-ulLoopStart_us;
+	if(ulDuration_us>ulLoopMaxDuration_us) ulLoopMaxDuration_us=ulDuration_us;
+	if(ulLoopBudget_us && ulDuration_us>ulLoopBudget_us) ulLoopOverruns++;
+
+	unsigned long ulDelay=GetNextLoopDelay();
+	ulNextLoop=millis()+ulDelay;
+	return ulDelay;
+}
+
+bool HomieDevice::HasImmediateWork()
 {
-	if(!bInitialized) return;
+	if(ringPost.Count()) return true;	//applied whether connected or not
 
+	if(bTransportBusy) return false;
 
-	if((int) (millis()-ulLastLoopTimestamp)>=iMainLoopInterval_ms)
+	bool bConnected=IsConnected() && GetEnableMQTT();
+
+	if(ringPostDirect.Count()) return true;	//sent, or dropped while disconnected
+	if(!bConnected) return false;
+
+	if(ringIncoming.Count()) return true;
+
+	for(size_t i=0;i<vecStream.size();i++)
 	{
-		ulLastLoopTimestamp+=iMainLoopInterval_ms;
+		HomieStreamProperty & stream=*vecStream[i];
+		if(!stream.GetInitialPublishingDone()) continue;
+		int iWaiting=stream.GetSamplesWaiting();
+		if(iWaiting && (iWaiting>=stream.iBatchSamples || millis()-stream.ulLastBatch>=stream.ulBatchInterval_ms)) return true;
 	}
-	else
+
+	return false;
+}
+
+static void HomieDeadline(int32_t & iNext, unsigned long ulSince, unsigned long ulInterval)
+{
+	int32_t iRemaining=(int32_t) (uint32_t) (ulInterval-(millis()-ulSince));
+	if(iRemaining<iNext) iNext=iRemaining;
+}
+
+unsigned long HomieDevice::GetNextLoopDelay()
+{
+	if(!bInitialized) return iMainLoopInterval_ms;
+
+	if(bWake || HasImmediateWork()) return 0;
+
+	int32_t iNext=1000;		//uptime counters
+	HomieDeadline(iNext,ulLastLoopSecondCounterTimestamp,1000);
+
+	//work that is left over was refused by the transport, retry at the polling interval
+	if(iPublishQueueCount || vecBatch.size() || bTransportBusy)
 	{
-		return;
+		iNext=min(iNext,(int32_t) iMainLoopInterval_ms);
+	}
+
+	bool bLink=WiFi.status() == WL_CONNECTED;
+#if defined(USE_ETHERNET) & defined(ARDUINO_ARCH_ESP32)
+	if(ETH.localIP()!=0) bLink=true;
+#endif
+
+	if(bLink && GetEnableMQTT())
+	{
+#if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
+		iNext=min(iNext,(int32_t) iMainLoopInterval_ms);	//incoming messages are polled
+#endif
+
+		if(IsConnected())
+		{
+			HomieDeadline(iNext,ulHomieStatsTimestamp,30000);
+
+			if(bDoInitialPublishing)
+			{
+				if(ulInitialPublishing) HomieDeadline(iNext,ulInitialPublishing,iInitialPublishingThrottle_ms);
+				else iNext=0;
+			}
+
+			if(bDoPublishDefaults) HomieDeadline(iNext,ulPublishDefaultsTimestamp,1);
+
+			if(iLazyPending) HomieDeadline(iNext,ulLazyPublishing,iInitialPublishingThrottle_ms);
+
+			if(bInitialPublishingDone && vecRefresh.size()) HomieDeadline(iNext,ulRefreshTimestamp,GetRefreshSlot_ms());
+
+			for(size_t i=0;i<vecLimited.size();i++)
+			{
+				HomiePublishLimit & limit=*vecLimited[i]->pLimit;
+				if(limit.bCoalescePending) HomieDeadline(iNext,limit.ulLastDelivery,limit.ulCoalesceWindow_ms);
+				if(!vecLimited[i]->GetInitialPublishingDone()) continue;
+				if(limit.bPending) HomieDeadline(iNext,limit.ulLastPublish,limit.ulMinInterval_ms);
+				if(limit.ulMaxInterval_ms) HomieDeadline(iNext,limit.ulLastPublish,limit.ulMaxInterval_ms);
+			}
+
+			for(size_t i=0;i<vecStream.size();i++)
+			{
+				if(vecStream[i]->GetSamplesWaiting()) HomieDeadline(iNext,vecStream[i]->ulLastBatch,vecStream[i]->ulBatchInterval_ms);
+			}
+
+			if(bInitialPublishingDone)
+			{
+				for(size_t i=0;i<vecNode.size();i++)
+				{
+					HomieNode & node=*vecNode[i];
+					if(!node.bJson || !node.bJsonDirty) continue;
+					if(node.ulJsonTimestamp) HomieDeadline(iNext,node.ulJsonTimestamp,node.ulJsonInterval_ms);
+					else iNext=0;
+				}
+			}
+		}
+		else if(bConnecting)
+		{
+			HomieDeadline(iNext,ulConnectTimestamp,ulConnectTimeout_ms+1);
+		}
+		else
+		{
+			HomieDeadline(iNext,ulLastReconnect,GetReconnectInterval()+1);
+		}
 	}
 
+	//anything still overdue right after a pass is blocked on the transport
+	if(iNext<=0) iNext=iMainLoopInterval_ms;
+
+	return iNext;
+}
+
+void HomieDevice::DoLoop()
+{
+	bTransportBusy=false;
+
+	DoPostQueue();
 
 	bool bEvenSecond=false;
 
@@ -295,7 +474,7 @@ void HomieDevice::Loop()
 			{
 				iWiFiRSSI=iWiFiRSSI_Current;
 
-				Publish( String(strTopic+"/$stats/signal").c_str(), 2, true, String(iWiFiRSSI).c_str());
+				Publish( String(strTopic+"/$stats/signal").c_str(), qosStats, true, String(iWiFiRSSI).c_str());
 			}
 		}
 
@@ -304,14 +483,6 @@ void HomieDevice::Loop()
 
 
 
-	static uint32_t ulFreeHeap=0xFFFFFFF;
-#if defined(ARDUINO_ARCH_ESP8266)
-	static uint16_t ulFreeHeapContig=0xFFFF;
-	static uint8_t uHeapFrag=0;
-#else
-	static uint32_t ulFreeHeapContig=0xFFFFFFF;
-#endif
-
 	if(bEvenSecond)
 	{
 		ulFreeHeap=min(ulFreeHeap,ESP.getFreeHeap());
@@ -341,9 +512,30 @@ void HomieDevice::Loop()
 		ulSecondCounter_Ethernet=0;
 #endif
 
+		bLinkUp=false;
 		return;
 	}
 
+	if(!bLinkUp)
+	{
+		bLinkUp=true;
+
+		//the link just came back, don't sit out the backoff
+		if(!IsConnected() && GetEnableMQTT() && ulReconnectAttempts)
+		{
+			csprintf("Link up, reconnecting right away\n");
+			if(bConnecting)
+			{
+				bConnecting=false;
+				DoDisconnect();
+			}
+			ulLastReconnect=0;
+			ulMqttReconnectCount=0;
+			ulReconnectInterval=0;
+			bWasConnected=false;	//the loss spread below is for a broker going away, not our own link
+		}
+	}
+
 #if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
 	pMQTT->loop();
 #endif
@@ -362,89 +554,51 @@ void HomieDevice::Loop()
 
 		bWasConnected=true;
 
-		DoInitialPublishing();
+		BeginCoalesce();
 
-//		pubsubClient.loop();
+		if(iInflight) ExpireInflight();
 
-		if((int) (millis()-ulHomieStatsTimestamp)>=30000)
-		{
-			bool bError=false;
+		DoIncomingQueue();
 
-			if(bInitialPublishingDone)
-			{
-				if(iRePublishReady<2 || (iRePublishReady & 15)==6)		//re-publish once in a while
-				{
-					bError |= 0==Publish(String(strTopic+"/$state").c_str(), ipub_qos, true, "ready");
-				}
-				iRePublishReady++;
-			}
+		DoPublishQueue();
 
-			String strExtensions="org.homie.legacy-stats:0.1.1:[4.x]";
+		if(bFlushChangedOffline) FlushChangedOffline();
 
-			if(strFirmwareName.length() || strFirmwareVersion.length())
-			{
-				strExtensions+=",org.homie.legacy-firmware:0.1.1:[4.x]";
-			}
+		DoInitialPublishing();	//one stage step per pass, paced by the throttle or the in-flight window
 
-			bError |= 0==Publish(String(strTopic+"/$extensions").c_str(), 2, true, strExtensions.c_str());
+		//the first of each kind always runs so nothing starves under a tight budget
+		for(size_t i=0;i<vecLimited.size() && (i==0 || HasLoopBudget());i++)
+		{
+			vecLimited[i]->DoLimits();
+		}
 
-			if(strFirmwareName.length())
-			{
-				bError |= 0==Publish(String(strTopic+"/$fw/name").c_str(), 2, true, strFirmwareName.c_str());
-			}
+		for(size_t i=0;i<vecStream.size() && (i==0 || HasLoopBudget());i++)
+		{
+			if(!vecStream[i]->DoStream()) bTransportBusy=true;
+		}
 
-			if(strFirmwareVersion.length())
+		if(bInitialPublishingDone)
+		{
+			for(size_t i=0;i<vecNode.size() && (i==0 || HasLoopBudget());i++)
 			{
-				bError |= 0==Publish(String(strTopic+"/$fw/version").c_str(), 2, true, strFirmwareVersion.c_str());
+				vecNode[i]->DoJsonPublishing();
 			}
+		}
 
+//		pubsubClient.loop();
 
-			bError |= 0==Publish(String(strTopic+"/$stats/uptime").c_str(), 2, true, String(ulSecondCounter_Uptime).c_str());
-			bError |= 0==Publish(String(strTopic+"/$stats/uptime-wifi").c_str(), 2, true, String(ulSecondCounter_WiFi).c_str());
-#if defined(USE_ETHERNET) & defined(ARDUINO_ARCH_ESP32)
-			bError |= 0==Publish(String(strTopic+"/$stats/uptime-ethernet").c_str(), 2, true, String(ulSecondCounter_Ethernet).c_str());
-#endif
-			bError |= 0==Publish(String(strTopic+"/$stats/uptime-mqtt").c_str(), 2, true, String(ulSecondCounter_MQTT).c_str());
-			bError |= 0==Publish(String(strTopic+"/$stats/signal").c_str(), 2, true, String(WiFi.RSSI()).c_str());
-			bError |= 0==Publish(String(strTopic+"/$stats/freeheap").c_str(), 2, true, String(ulFreeHeap).c_str());
-
-			bError |= 0==Publish(String(strTopic+"/$stats/freeheap_contiguous").c_str(), 2, true, String(ulFreeHeapContig).c_str());
-
-
-			ulFreeHeap=0xFFFFFFF;
-#if defined(ARDUINO_ARCH_ESP8266)
-			ulFreeHeapContig=0xFFFF;
-			bError |= 0==Publish(String(strTopic+"/$stats/heapfrag").c_str(), 2, true, String(uHeapFrag).c_str());
-			uHeapFrag=0;
-#else
-			ulFreeHeapContig=0xFFFFFFF;
-#endif
-
-
-			if(bError)
-			{
-				ulHomieStatsTimestamp=millis()-(30000-GetErrorRetryFrequency());	//retry in a while
-			}
-			else
-			{
-				ulHomieStatsTimestamp=millis();
-				bTelemetrySent=true;
-			}
+		DoStats();
 
-//			csprintf("Periodic publishing: %i, %i, %i\n",pub_return[0],pub_return[1],pub_return[2]);
+		if(bDoPublishDefaults && !iPublishQueueCount && (int) (millis()-ulPublishDefaultsTimestamp)>0)
+		{
+			DoPublishDefaults();
 		}
 
-		if(bDoPublishDefaults && (int) (millis()-ulPublishDefaultsTimestamp)>0)
-		{
-			bDoPublishDefaults=0;
+		if(iLazyPending) DoLazyPublishing();
 
-			for(size_t a=0;a<vecNode.size();a++)
-			{
-				vecNode[a]->PublishDefaults();
-			}
-		}
+		if(bInitialPublishingDone && vecRefresh.size()) DoRefresh();
 
-		DoLazyPublishing();
+		EndCoalesce();
 
 
 	}
@@ -456,9 +610,19 @@ void HomieDevice::Loop()
 		ulSecondCounter_MQTT=0;
 
 		ulHomieStatsTimestamp=millis()-1000000;
+		iStatsStage=-1;
+		bStatsPhased=false;
 
 		bTelemetrySent=false;
 
+		if(bWasConnected)
+		{
+			//connection lost. spread the first attempt so a broker restart isn't hit by every device at once
+			bWasConnected=false;
+			ulLastReconnect=millis();
+			ulReconnectInterval=HomieLossSpread_ms(ulReconnectMin_ms,HomieRandom());
+		}
+
 		if(GetEnableMQTT())
 		{
 
@@ -471,12 +635,17 @@ void HomieDevice::Loop()
 				{
 					//csprintf("x");
 
+					if(bRoutesDirty) AddNewSubscriptions();	//no session, so the transport isn't looking up routes
+
 					IPAddress ip;
 					ip.fromString(strMqttServerIP);
 					//ip.fromString("172.22.22.99");
 
 					ulLastReconnect=millis();
 					ulMqttReconnectCount++;
+					ulReconnectAttempts++;
+					if(!ulOutageStart) ulOutageStart=millis();
+					NextReconnectInterval();
 
 					csprintf("Connecting to MQTT server %s... (%s)\n",strMqttServerIP.c_str(),GetMqttLibraryID());
 					bConnecting=true;
@@ -490,41 +659,64 @@ void HomieDevice::Loop()
 					mqtt.setServer(ip,1883);//1883
 					mqtt.setCredentials(strMqttUserName.c_str(), strMqttPassword.c_str());
 					mqtt.connect();
-#elif defined(USE_ARDUINOMQTT)
-
-					pMQTT->begin(ip, net);
-					
-					int ret=pMQTT->connect( strClientID.c_str(), strMqttUserName.c_str(), strMqttPassword.c_str());
-					if(ret)
-					{
-						//csprintf("MQTT connect %s %s %s returned %i\n",strID.c_str(), strMqttUserName.c_str(), strMqttPassword.c_str(),ret);
-						onConnect(false);
-					}
-#elif defined(USE_PUBSUBCLIENT)
+#elif defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
+#if defined(USE_ARDUINOMQTT)
+					pMQTT->begin(ip, netCoalesce);
+#else
 					pMQTT->setServer(ip,1883);
 					csprintf("connecting with ID %s\n",strID.c_str());
+#endif
 
 #ifdef HOMIELIB_CONNECT_ASYNC
-					bDoConnect=true;
-#else
-
-					int ret=pMQTT->connect(strClientID.c_str(), strMqttUserName.c_str(), strMqttPassword.c_str(), szWillTopic, 1, 1, "lost");
-					if(ret)
+					if(StartConnectTask())	//retried here in case there wasn't enough memory at Init
 					{
-						onConnect(false);
+						bDoConnect=true;
+						workerConnect.Signal();
 					}
+					else
 #endif
+					{
+						//open the socket now and do the MQTT handshake on the next pass, each bounded by ulConnectStepTimeout_ms
+						net.setTimeout(ulConnectStepTimeout_ms);
+						bConnectSession=net.connect(ip,1883);
+						if(bConnectSession)
+						{
+							Wake();
+						}
+						else
+						{
+							onDisconnect(0);
+						}
+					}
 #endif
 
 				}
 			}
 			else
 			{
-				//if we're still not connected after a minute, try again
-				if(!ulConnectTimestamp || (millis()-ulConnectTimestamp)>60000)
+#if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
+				if(bConnectSession)
+				{
+					bConnectSession=false;
+					if(ConnectSession(true))
+					{
+						onConnect(false);
+					}
+					else
+					{
+						net.stop();
+						onDisconnect(0);
+					}
+				}
+#endif
+
+				//give up on an attempt that neither connected nor failed in time
+				if(!ulConnectTimestamp || (millis()-ulConnectTimestamp)>ulConnectTimeout_ms)
 				{
-					csprintf("Reconnect needed, dangling flag\n");
+					csprintf("MQTT connect timed out after %lums\n",millis()-ulConnectTimestamp);
+					ulConnectTimeouts++;
 					bConnecting=false;
+					ulLastReconnect=millis();
 					DoDisconnect();
 				}
 
@@ -557,8 +749,17 @@ void HomieDevice::onConnect(bool sessionPresent)
 	csprintf("onConnect... %p\n",this);
 #endif
 	bConnecting=false;
+	Wake();
+
+	if(ulOutageStart)
+	{
+		ulLastTimeToConnect_ms=millis()-ulOutageStart;
+		if(ulLastTimeToConnect_ms>ulMaxTimeToConnect_ms) ulMaxTimeToConnect_ms=ulLastTimeToConnect_ms;
+		ulOutageStart=0;
+	}
 
 	bDoInitialPublishing=true;
+	bCommandsReady=false;
 	iInitialPublishing=0;
 	iInitialPublishing_Node=0;
 	iInitialPublishing_Prop=0;
@@ -566,17 +767,13 @@ void HomieDevice::onConnect(bool sessionPresent)
 
 	ulSecondCounter_MQTT=0;
 
-	for(size_t i=0;i<vecNode.size();i++)
+	ClearInflight();
+
+	for(size_t i=0;i<vecAllProperties.size();i++)
 	{
-		HomieNode & node=*vecNode[i];
-		for(size_t j=0;j<node.vecProperty.size();j++)
-		{
-			node.vecProperty[j]->SetInitialPublishingDone(false);
-			node.vecProperty[j]->SetNeedsPublish(false);
-		}
+		vecAllProperties[i]->ResetConnectionFlags();
 	}
-
-	mapIncoming.clear();
+	iLazyPending=0;
 
 #if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
 	listUnsubQueue.clear();
@@ -603,6 +800,8 @@ void HomieDevice::onDisconnect(int8_t reason)
 	(void)(reason);
 #endif
 	csprintf("onDisconnect...");
+	Wake();
+	ClearInflight();
 	if(bConnecting)
 	{
 		ulLastReconnect=millis();
@@ -641,20 +840,35 @@ void HomieDevice::onMqttMessage(char* topic, byte* payload, unsigned int len)
 	void * properties=NULL;
 	uint8_t total=0; uint8_t index=0;
 #endif
-	String strTopic=topic;
-	_map_incoming::const_iterator citer=mapIncoming.find(strTopic);
+	HomieProperty * pProp=FindRoute(topic);
+	if(!pProp && !fnMessageCallback) return;
+
+	if(ringIncoming.IsEnabled())
+	{
+		QueueIncoming(pProp,topic,(const uint8_t *) payload,len,index);
+		return;
+	}
+
+	HandleMessage(pProp, topic, payload, properties, len, index, total);
+}
 
+#if defined(USE_PANGOLIN)
+void HomieDevice::HandleMessage(HomieProperty * pProp, const char* topic, uint8_t * payload, PANGO_PROPS & properties, size_t len, size_t index, size_t total)
+#elif defined(USE_ASYNCMQTTCLIENT)
+void HomieDevice::HandleMessage(HomieProperty * pProp, char* topic, char* payload, AsyncMqttClientMessageProperties & properties, size_t len, size_t index, size_t total)
+#elif defined(USE_ARDUINOMQTT)
+void HomieDevice::HandleMessage(HomieProperty * pProp, char* topic, char* payload, void * properties, size_t len, size_t index, size_t total)
+#elif defined(USE_PUBSUBCLIENT)
+void HomieDevice::HandleMessage(HomieProperty * pProp, char* topic, byte* payload, void * properties, unsigned int len, int index, int total)
+#endif
+{
 	if(fnMessageCallback && fnMessageCallback(topic,(uint8_t *) payload,len)) return;
 
-	if(citer!=mapIncoming.end())
+	if(pProp)
 	{
-		HomieProperty * pProp=citer->second;
-		if(pProp)
-		{
 
-			pProp->OnMqttMessage(topic, payload, properties, len, index, total);
+		pProp->OnMqttMessage(topic, payload, properties, len, index, total);
 
-		}
 	}
 
 
@@ -662,23 +876,269 @@ void HomieDevice::onMqttMessage(char* topic, byte* payload, unsigned int len)
 }
 
 
-HomieProperty * HomieDevice::NewSubscription(const String & strTopic)
+bool HomieDevice::QueueIncoming(HomieProperty * pProp, const char * topic, const uint8_t * payload, size_t len, size_t index)
 {
-	if(!vecNode.size())
+	if(index!=0) return false;	//continuation of a fragmented message, only the first part is handled
+
+	size_t topic_len=strlen(topic);
+	if(topic_len>=HOMIELIB_INBOUND_TOPIC_MAX || len>HOMIELIB_INBOUND_PAYLOAD_MAX)
 	{
-		HomieNode * pNode=NewNode();
-		pNode->strID="subs";
-		pNode->strFriendlyName="MQTT subs";
+		ulIncomingOversize++;
+		return false;
 	}
 
-	HomieProperty * ret;
+	HomieIncomingMessage * pMsg=ringIncoming.BeginPush();
+	if(!pMsg)
+	{
+		ulIncomingOverflows++;
+		return false;
+	}
 
+	pMsg->pProp=pProp;
+	memcpy(pMsg->szTopic,topic,topic_len+1);
+	memcpy(pMsg->payload,payload,len);
+	pMsg->length=len;
 
-	_map_incoming::const_iterator citer=mapPlainSubscriptions.find(strTopic);
-	if(citer!=mapPlainSubscriptions.end())
-	{
-#ifdef HOMIELIB_VERBOSE
-		csprintf("PIGGYBACK %s\n",strTopic.c_str());
+	ringIncoming.CommitPush();
+	return true;
+}
+
+void HomieDevice::DoIncomingQueue()
+{
+	HomieIncomingMessage * pMsg;
+
+	for(int i=0;(pMsg=ringIncoming.Front())!=NULL && (i==0 || HasLoopBudget());i++)
+	{
+#if defined(USE_PANGOLIN)
+		PANGO_PROPS properties={};
+		HandleMessage(pMsg->pProp, pMsg->szTopic, pMsg->payload, properties, pMsg->length, 0, pMsg->length);
+#elif defined(USE_ASYNCMQTTCLIENT)
+		AsyncMqttClientMessageProperties properties={};
+		HandleMessage(pMsg->pProp, pMsg->szTopic, (char *) pMsg->payload, properties, pMsg->length, 0, pMsg->length);
+#elif defined(USE_ARDUINOMQTT)
+		HandleMessage(pMsg->pProp, pMsg->szTopic, (char *) pMsg->payload, NULL, pMsg->length, 0, pMsg->length);
+#elif defined(USE_PUBSUBCLIENT)
+		HandleMessage(pMsg->pProp, pMsg->szTopic, pMsg->payload, NULL, pMsg->length, 0, pMsg->length);
+#endif
+		ringIncoming.Pop();
+	}
+}
+
+bool HomieDevice::PostValue(const HomiePostedValue & value)
+{
+	uint32_t pos;
+	HomiePostedValue * pSlot=ringPost.BeginPush(pos);
+	if(!pSlot)
+	{
+		ulPostOverflows++;
+		return false;
+	}
+
+	*pSlot=value;
+	ringPost.CommitPush(pos);
+	return true;
+}
+
+bool HomieDevice::PostDirect(const char * topic, uint8_t qos, bool retain, const uint8_t * payload, uint32_t length)
+{
+	if(!ringPostDirect.IsEnabled())
+	{
+		return PublishDirectUint8(topic,qos,retain,payload,length)!=0;	//like Post* without a queue
+	}
+
+	size_t topic_len=strlen(topic);
+	if(topic_len>=HOMIELIB_INBOUND_TOPIC_MAX || length>HOMIELIB_POST_PAYLOAD_MAX) return false;
+
+	uint32_t pos;
+	HomiePostedPublish * pSlot=ringPostDirect.BeginPush(pos);
+	if(!pSlot)
+	{
+		ulPostOverflows++;
+		return false;
+	}
+
+	memcpy(pSlot->szTopic,topic,topic_len+1);
+	memcpy(pSlot->payload,payload,length);
+	pSlot->length=length;
+	pSlot->qos=qos;
+	pSlot->retain=retain;
+
+	ringPostDirect.CommitPush(pos);
+	return true;
+}
+
+void HomieDevice::DoPostQueue()
+{
+	HomiePostedValue * pValue;
+	for(int i=0;(pValue=ringPost.Front())!=NULL && (i==0 || HasLoopBudget());i++)
+	{
+		HomieProperty * pProp=pValue->pProp;
+		switch((eHomiePostType) pValue->type)
+		{
+		case homiePostInt:
+			pProp->SetInt(pValue->iValue);
+			break;
+		case homiePostFloat:
+			pProp->SetFloat(pValue->fValue,pValue->decimals);
+			break;
+		case homiePostBool:
+			pProp->SetBool(pValue->bValue);
+			break;
+		case homiePostString:
+			pProp->SetValue(pValue->szValue);
+			break;
+		}
+		ringPost.Pop();
+	}
+
+	HomiePostedPublish * pPublish;
+	for(int i=0;(pPublish=ringPostDirect.Front())!=NULL && (i==0 || HasLoopBudget());i++)
+	{
+		if(IsConnected() && !PublishDirectUint8(pPublish->szTopic, pPublish->qos, pPublish->retain, pPublish->payload, pPublish->length))
+		{
+			bTransportBusy=true;
+			break;	//transport full, leave it for next time
+		}
+		ringPostDirect.Pop();	//sent, or dropped while disconnected just like PublishDirect
+	}
+}
+
+void HomieDevice::BuildRefreshSlots()
+{
+	vecRefresh.clear();
+	memset(uRefreshSlotStart,0,sizeof(uRefreshSlotStart));
+	if(!ulRefreshInterval_ms) return;
+
+	std::vector<uint8_t> vecSlot;
+
+	for(size_t i=0;i<vecAllProperties.size();i++)
+	{
+		HomieProperty * pProp=vecAllProperties[i];
+		if(pProp->GetIsStandardMQTT() || pProp->GetIsStream()) continue;
+		if(!pProp->GetFakeRetained() && !bRefreshAll) continue;
+
+		//the device id is part of the seed so identical devices don't refresh the same property at the same time
+		uint32_t ulHash=HomieHash(pProp->strID.c_str(),HomieHash(pProp->pParent->strID.c_str(),ulPhaseSeed));
+		vecRefresh.push_back(pProp);
+		vecSlot.push_back(HomiePhaseOffset(ulHash,HOMIELIB_REFRESH_SLOTS));
+		uRefreshSlotStart[vecSlot.back()+1]++;
+	}
+
+	//counting sort into slots
+	for(int i=0;i<HOMIELIB_REFRESH_SLOTS;i++) uRefreshSlotStart[i+1]+=uRefreshSlotStart[i];
+
+	std::vector<HomieProperty *> vecSorted(vecRefresh.size());
+	uint16_t uNext[HOMIELIB_REFRESH_SLOTS];
+	memcpy(uNext,uRefreshSlotStart,sizeof(uNext));
+	for(size_t i=0;i<vecRefresh.size();i++) vecSorted[uNext[vecSlot[i]]++]=vecRefresh[i];
+	vecRefresh.swap(vecSorted);
+
+	iRefreshSlot=HomiePhaseOffset(ulPhaseSeed,HOMIELIB_REFRESH_SLOTS);
+}
+
+void HomieDevice::DoRefresh()
+{
+	unsigned long ulSlot_ms=GetRefreshSlot_ms();
+	if((int) (millis()-ulRefreshTimestamp)<(int) ulSlot_ms) return;
+
+	if(iPublishQueueCount) return;	//back off while the transport is refusing publishes
+	if(!HasInflightRoom()) return;
+
+	ulRefreshTimestamp+=ulSlot_ms;
+	if((int) (millis()-ulRefreshTimestamp)>(int) ulSlot_ms) ulRefreshTimestamp=millis();	//fell behind, don't burst to catch up
+
+	for(int i=uRefreshSlotStart[iRefreshSlot];i<uRefreshSlotStart[iRefreshSlot+1];i++)
+	{
+		if(vecRefresh[i]->Publish()) ulRefreshCount++;
+	}
+
+	if(++iRefreshSlot>=HOMIELIB_REFRESH_SLOTS) iRefreshSlot=0;
+}
+
+void HomieDevice::BuildRoutes()
+{
+	vecRoutes.clear();
+	vecRouteTopics.clear();
+
+	for(size_t i=0;i<vecAllProperties.size();i++)
+	{
+		HomieProperty * pProp=vecAllProperties[i];
+		String strTopics[2];
+		int iTopics=0;
+
+		if(pProp->GetIsStandardMQTT())
+		{
+			strTopics[iTopics++]=pProp->GetTopic();
+		}
+		else if(pProp->GetSettable())
+		{
+			strTopics[iTopics++]=pProp->GetTopic();
+			strTopics[iTopics++]=pProp->GetSetTopic();
+		}
+
+		for(int t=0;t<iTopics;t++)
+		{
+			HomieRoute route;
+			route.uTopicOffset=vecRouteTopics.size();
+			route.pProp=pProp;
+			vecRouteTopics.insert(vecRouteTopics.end(),strTopics[t].c_str(),strTopics[t].c_str()+strTopics[t].length()+1);
+			vecRoutes.push_back(route);
+		}
+	}
+
+	const char * pTopics=vecRouteTopics.data();
+	std::sort(vecRoutes.begin(),vecRoutes.end(),[pTopics](const HomieRoute & a, const HomieRoute & b)
+			{
+				return strcmp(pTopics+a.uTopicOffset,pTopics+b.uTopicOffset)<0;
+			});
+
+	bRoutesDirty=false;
+}
+
+void HomieDevice::AddNewSubscriptions()
+{
+	vecAllProperties.insert(vecAllProperties.end(),vecNewSubscriptions.begin(),vecNewSubscriptions.end());
+	vecNewSubscriptions.clear();
+
+	BuildRoutes();
+	BuildInitialOrder();
+}
+
+void HomieDevice::BuildInitialOrder()
+{
+	vecInitialOrder=vecAllProperties;
+	std::stable_partition(vecInitialOrder.begin(),vecInitialOrder.end(),[](HomieProperty * pProp) { return pProp->GetPriority(); });
+}
+
+HomieProperty * HomieDevice::FindRoute(const char * topic)
+{
+	const char * pTopics=vecRouteTopics.data();
+	std::vector<HomieRoute>::const_iterator iter=std::lower_bound(vecRoutes.begin(),vecRoutes.end(),topic,[pTopics](const HomieRoute & route, const char * topic)
+			{
+				return strcmp(pTopics+route.uTopicOffset,topic)<0;
+			});
+
+	if(iter!=vecRoutes.end() && !strcmp(pTopics+iter->uTopicOffset,topic)) return iter->pProp;
+	return NULL;
+}
+
+HomieProperty * HomieDevice::NewSubscription(const String & strTopic)
+{
+	if(!vecNode.size())
+	{
+		HomieNode * pNode=NewNode();
+		pNode->strID="subs";
+		pNode->strFriendlyName="MQTT subs";
+	}
+
+	HomieProperty * ret;
+
+
+	_map_incoming::const_iterator citer=mapPlainSubscriptions.find(strTopic);
+	if(citer!=mapPlainSubscriptions.end())
+	{
+#ifdef HOMIELIB_VERBOSE
+		csprintf("PIGGYBACK %s\n",strTopic.c_str());
 #endif
 		ret=citer->second;
 	}
@@ -687,6 +1147,12 @@ HomieProperty * HomieDevice::NewSubscription(const String & strTopic)
 		ret=vecNode[0]->NewProperty();
 		ret->SetStandardMQTT(strTopic);
 		mapPlainSubscriptions[strTopic]=ret;
+
+		if(bInitialized)
+		{
+			vecNewSubscriptions.push_back(ret);
+			bRoutesDirty=true;
+		}
 	}
 
 
@@ -713,8 +1179,51 @@ void HomieDevice::HandleInitialPublishingError()
 }
 
 
+void HomieDevice::QueuePublish(HomieProperty * pProp)
+{
+	if(pProp->GetQueued()) return;
+
+	if(iPublishQueueCount>=(int) vecPublishQueue.size())
+	{
+		//queue full, leave it to lazy publishing so the value isn't lost
+		ulPublishQueueOverflows++;
+		pProp->SetNeedsPublish(true);
+		return;
+	}
+
+	vecPublishQueue[(iPublishQueueHead+iPublishQueueCount) % vecPublishQueue.size()]=pProp;
+	iPublishQueueCount++;
+	if(iPublishQueueCount>iPublishQueueHighWater) iPublishQueueHighWater=iPublishQueueCount;
+
+	pProp->SetQueued(true);
+	Wake();
+}
+
+void HomieDevice::DoPublishQueue()
+{
+	for(int i=0;iPublishQueueCount && (i==0 || HasLoopBudget());i++)
+	{
+		HomieProperty * pProp=vecPublishQueue[iPublishQueueHead];
+
+		if(!pProp->SendValue())
+		{
+			bTransportBusy=true;
+			break;	//still no room, try again next time
+		}
+
+		pProp->SetQueued(false);
+		iPublishQueueHead=(iPublishQueueHead+1) % vecPublishQueue.size();
+		iPublishQueueCount--;
+
+		yield();
+	}
+}
+
 void HomieDevice::DoLazyPublishing()
 {
+	if(iPublishQueueCount) return;	//back off while the transport is refusing publishes
+	if(!HasInflightRoom()) return;
+
 	if(ulLazyPublishing!=0 && (int) (millis()-ulLazyPublishing)<iInitialPublishingThrottle_ms)
 	{
 		return;
@@ -759,13 +1268,6 @@ void HomieDevice::DoLazyPublishing()
 
 void HomieDevice::DoInitialPublishing()
 {
-#if defined(USE_ARDUINOMQTT)
-	MQTTClient & mqtt=*pMQTT;
-#elif defined(USE_PUBSUBCLIENT)
-	PubSubClient & mqtt=*pMQTT;
-#endif
-
-
 	if(!bDoInitialPublishing)
 	{
 		iInitialPublishing=0;
@@ -774,11 +1276,17 @@ void HomieDevice::DoInitialPublishing()
 		return;
 	}
 
-	if(ulInitialPublishing!=0 && (int) (millis()-ulInitialPublishing)<iInitialPublishingThrottle_ms)
+	//paced by acknowledgements when there's an in-flight window, by the throttle otherwise
+	if(ulInitialPublishing!=0 && (int) (millis()-ulInitialPublishing)<(GetInflightWindow() ? 0 : iInitialPublishingThrottle_ms))
 	{
 		return;
 	}
 
+	if(iPublishQueueCount) return;	//back off while the transport is refusing publishes
+
+	if(!HasInflightRoom()) return;
+	if(GetInflightWindow()) Wake();
+
 	if(!ulInitialPublishing)
 	{
 		csprintf("%s MQTT Initial Publishing...\n",strTopic.c_str());
@@ -799,22 +1307,54 @@ void HomieDevice::DoInitialPublishing()
 	if(iInitialPublishing==0)
 	{
 		bool bError=false;
-		bError |= 0==Publish(String(strTopic+"/$state").c_str(), ipub_qos, true, "init");
-		bError |= 0==Publish(String(strTopic+"/$homie").c_str(), ipub_qos, true, "4.0.0");
-		bError |= 0==Publish(String(strTopic+"/$name").c_str(), ipub_qos, true, strFriendlyName.c_str());
+		bError |= 0==Publish(String(strTopic+"/$state").c_str(), qosAttributes, true, "init");
+		bError |= 0==Publish(String(strTopic+"/$homie").c_str(), qosAttributes, true, "4.0.0");
+		bError |= 0==Publish(String(strTopic+"/$name").c_str(), qosAttributes, true, strFriendlyName.c_str());
 		if(bError)
 		{
 			HandleInitialPublishingError();
 		}
 		else
 		{
+			iInitialPublishing_Prop=0;
 			iInitialPublishing=1;
 		}
 
 		return;
 	}
 
+	//values and subscriptions first, priority properties leading, so commands work as early as possible
 	if(iInitialPublishing==1)
+	{
+		for(int n=0;n<iInitialPublishingBurst && iInitialPublishing_Prop<(int) vecInitialOrder.size();n++)
+		{
+			HomieProperty & prop=*vecInitialOrder[iInitialPublishing_Prop];
+
+#ifdef HOMIELIB_VERBOSE
+			if(bDebug) csprintf("COMMAND %i: %s\n",iInitialPublishing_Prop,prop.strFriendlyName.c_str());
+#endif
+
+			if(InitialPublishValue(prop))
+			{
+				HandleInitialPublishingError();
+				return;
+			}
+
+			iInitialPublishing_Prop++;
+		}
+
+		if(iInitialPublishing_Prop>=(int) vecInitialOrder.size())
+		{
+			bCommandsReady=true;
+			ulCommandsReady_ms=millis()-ulConnectTimestamp;
+			csprintf("%s commands ready after %lums\n",strTopic.c_str(),ulCommandsReady_ms);
+
+			iInitialPublishing=2;
+		}
+		return;
+	}
+
+	if(iInitialPublishing==2)
 	{
 		bool bError=false;
 		String strIP=WiFi.localIP().toString();
@@ -827,9 +1367,9 @@ void HomieDevice::DoInitialPublishing()
 		}
 #endif
 
-		bError |= 0==Publish(String(strTopic+"/$localip").c_str(), ipub_qos, true, strIP.c_str());
-		bError |= 0==Publish(String(strTopic+"/$mac").c_str(), ipub_qos, true, strMAC.c_str());
-		bError |= 0==Publish(String(strTopic+"/$extensions").c_str(), ipub_qos, true, "");
+		bError |= 0==Publish(String(strTopic+"/$localip").c_str(), qosAttributes, true, strIP.c_str());
+		bError |= 0==Publish(String(strTopic+"/$mac").c_str(), qosAttributes, true, strMAC.c_str());
+		bError |= 0==Publish(String(strTopic+"/$extensions").c_str(), qosAttributes, true, "");
 
 		if(bError)
 		{
@@ -837,21 +1377,25 @@ void HomieDevice::DoInitialPublishing()
 		}
 		else
 		{
-			iInitialPublishing=2;
+			iInitialPublishing=3;
 		}
 		return;
 	}
 
-	if(iInitialPublishing==2)
+	if(iInitialPublishing==3)
 	{
 		bool bError=false;
 
-		bError |= 0==Publish(String(strTopic+"/$stats").c_str(), ipub_qos, true, "uptime,signal,uptime-wifi,"
+		bError |= 0==Publish(String(strTopic+"/$stats").c_str(), qosAttributes, true, "uptime,signal,uptime-wifi,"
 #if defined(USE_ETHERNET) & defined(ARDUINO_ARCH_ESP32)
 				"uptime-ethernet,"
 #endif
-				"uptime-mqtt,freeheap,freeheap_contiguous,heapfrag");
-		bError |= 0==Publish(String(strTopic+"/$stats/interval").c_str(), ipub_qos, true, "60");
+				"uptime-mqtt,freeheap,freeheap_contiguous,heapfrag"
+#ifdef HOMIELIB_CONNECT_ASYNC
+				",connecttask_stackfree"
+#endif
+				);
+		bError |= 0==Publish(String(strTopic+"/$stats/interval").c_str(), qosAttributes, true, "60");
 
 		String strNodes;
 		for(size_t i=0;i<vecNode.size();i++)
@@ -864,7 +1408,7 @@ void HomieDevice::DoInitialPublishing()
 		if(bDebug) csprintf("NODES: %s\n",strNodes.c_str());
 #endif
 
-		bError |= 0==Publish(String(strTopic+"/$nodes").c_str(), ipub_qos, true, strNodes.c_str());
+		bError |= 0==Publish(String(strTopic+"/$nodes").c_str(), qosAttributes, true, strNodes.c_str());
 
 		if(bError)
 		{
@@ -873,13 +1417,13 @@ void HomieDevice::DoInitialPublishing()
 		else
 		{
 			iInitialPublishing_Node=0;
-			iInitialPublishing=3;
+			iInitialPublishing=4;
 		}
 		return;
 	}
 
 
-	if(iInitialPublishing==3)
+	if(iInitialPublishing==4)
 	{
 		bool bError=false;
 		int i=iInitialPublishing_Node;
@@ -890,8 +1434,8 @@ void HomieDevice::DoInitialPublishing()
 			if(bDebug) csprintf("NODE %i: %s\n",i,node.strFriendlyName.c_str());
 #endif
 
-			bError |= 0==Publish(String(node.GetTopic()+"/$name").c_str(), ipub_qos, true, node.strFriendlyName.c_str());
-			bError |= 0==Publish(String(node.GetTopic()+"/$type").c_str(), ipub_qos, true, node.strType.c_str());
+			bError |= 0==Publish(String(node.GetTopic()+"/$name").c_str(), qosAttributes, true, node.strFriendlyName.c_str());
+			bError |= 0==Publish(String(node.GetTopic()+"/$type").c_str(), qosAttributes, true, node.strType.c_str());
 
 			String strProperties;
 			for(size_t j=0;j<node.vecProperty.size();j++)
@@ -907,7 +1451,7 @@ void HomieDevice::DoInitialPublishing()
 			if(bDebug) csprintf("NODE %i: %s has properties %s\n",i,node.strFriendlyName.c_str(),strProperties.c_str());
 #endif
 
-			bError |= 0==Publish(String(node.GetTopic()+"/$properties").c_str(), ipub_qos, true, strProperties.c_str());
+			bError |= 0==Publish(String(node.GetTopic()+"/$properties").c_str(), qosAttributes, true, strProperties.c_str());
 
 			if(bError)
 			{
@@ -923,171 +1467,390 @@ void HomieDevice::DoInitialPublishing()
 
 		if(i>=(int) vecNode.size())
 		{
-			iInitialPublishing=4;
+			iInitialPublishing=5;
 			iInitialPublishing_Node=0;
 			iInitialPublishing_Prop=0;
 		}
 	}
 
-	if(iInitialPublishing==4)
+	if(iInitialPublishing==5)
 	{
-		bool bError=false;
-		int i=iInitialPublishing_Node;
+		HomieProperty * pProp;
+		int iNode=iInitialPublishing_Node;
+		int iProp=iInitialPublishing_Prop;
 
-		if(i<(int) vecNode.size())
+		while((pProp=StepProperty(iNode,iProp))!=NULL && pProp->GetIsStandardMQTT())
 		{
-			HomieNode & node=*vecNode[i];
+			iInitialPublishing_Node=iNode;	//plain subscriptions have no attributes
+			iInitialPublishing_Prop=iProp;
+		}
+
+		if(pProp)
+		{
+			HomieProperty & prop=*pProp;
+			bool bError=false;
+
 #ifdef HOMIELIB_VERBOSE
-			if(bDebug) csprintf("NODE %i: %s\n",i,node.strFriendlyName.c_str());
+			if(bDebug) csprintf("NODE %i: property %s\n",iNode,prop.strFriendlyName.c_str());
 #endif
 
-			int j=iInitialPublishing_Prop;
-			if(j<(int) node.vecProperty.size())
+			bError |= 0==Publish(String(prop.GetTopic()+"/$name").c_str(), qosAttributes, true, prop.strFriendlyName.c_str());
+			bError |= 0==Publish(String(prop.GetTopic()+"/$settable").c_str(), qosAttributes, true, prop.GetSettable()?"true":"false");
+			bError |= 0==Publish(String(prop.GetTopic()+"/$retained").c_str(), qosAttributes, true, (prop.GetRetained() || prop.GetFakeRetained())?"true":"false");
+			bError |= 0==Publish(String(prop.GetTopic()+"/$datatype").c_str(), qosAttributes, true, GetHomieDataTypeText((eHomieDataType) prop.datatype));
+			if(prop.pstrUnit && prop.pstrUnit->length())
 			{
-				bool bSuccess=false;
-				HomieProperty & prop=*node.vecProperty[j];
+				bError |= 0==Publish(String(prop.GetTopic()+"/$unit").c_str(), qosAttributes, true, prop.pstrUnit->c_str());
+			}
+			if(prop.strFormat.length())
+			{
+				bError |= 0==Publish(String(prop.GetTopic()+"/$format").c_str(), qosAttributes, true, prop.strFormat.c_str());
+			}
 
-#ifdef HOMIELIB_VERBOSE
-				if(bDebug) csprintf("NODE %i: %s property %s\n",i,node.strFriendlyName.c_str(),prop.strFriendlyName.c_str());
+			if(bError)
+			{
+				HandleInitialPublishingError();
+			}
+			else
+			{
+				iInitialPublishing_Node=iNode;
+				iInitialPublishing_Prop=iProp;
+				iPubCount_Props++;
+			}
+
+			return;
+		}
+
+		iInitialPublishing_Node=0;
+		iInitialPublishing_Prop=0;
+		iInitialPublishing=6;
+	}
+
+	if(iInitialPublishing==6)
+	{
+		bool bError=false;
+		bError |= 0==Publish(String(strTopic+"/$state").c_str(), qosAttributes, true, "ready");
+
+		if(bError)
+		{
+			HandleInitialPublishingError();
+		}
+		else
+		{
+			bDoInitialPublishing=false;
+			csprintf("Initial publishing complete. %i nodes, %i properties\n",vecNode.size(),iPubCount_Props);
+			FinishInitialPublishing(this);
+
+			bInitialPublishingDone=true;
+			bWasReady=true;
+
+			bFlushChangedOffline=true;
+			iFlushNodeIdx=0;
+			iFlushPropIdx=0;
+			iFlushCount=0;
+
+			for(size_t i=0;i<vecNode.size();i++)
+			{
+				vecNode[i]->bJsonDirty=vecNode[i]->bJson;
+			}
+
+			iRePublishReady=0;
+
+			//start the refresh round on this device's own phase, everything was just published
+			ulRefreshTimestamp=millis()+HomiePhaseOffset(ulPhaseSeed,GetRefreshSlot_ms());
+
+			ulPublishDefaultsTimestamp=millis()+15000;
+			bDoPublishDefaults=true;
+			iPublishDefaultsNodeIdx=0;
+			iPublishDefaultsPropIdx=0;
+
+			ulMqttReconnectCount=0;
+
+		}
+
+
+	}
+
+}
+
+bool HomieDevice::InitialPublishValue(HomieProperty & prop)
+{
+#if defined(USE_ARDUINOMQTT)
+	MQTTClient & mqtt=*pMQTT;
+#elif defined(USE_PUBSUBCLIENT)
+	PubSubClient & mqtt=*pMQTT;
 #endif
 
-				if(prop.GetIsStandardMQTT())
-				{
+	bool bError=false;
+	bool bSuccess=false;
 
-					bError |= 0==(bSuccess=mqtt.subscribe(prop.GetTopic().c_str(), sub_qos));
-					mapIncoming[prop.GetTopic()]=&prop;
+	if(prop.GetIsStandardMQTT())
+	{
 #ifdef HOMIELIB_VERBOSE
-					csprintf("SUBSCRIBING to MQTT topic %s (ID=%s): ",prop.GetTopic().c_str(),prop.strID.c_str());
+		csprintf("SUBSCRIBING to MQTT topic %s (ID=%s): ",prop.GetTopic().c_str(),prop.strID.c_str());
 #endif
-
+		bError |= 0==(bSuccess=mqtt.subscribe(prop.GetTopic().c_str(), prop.GetSubscribeQos()));
 #ifdef HOMIELIB_VERBOSE
-					csprintf("%s\n",bSuccess?"OK":"FAIL");
+		csprintf("%s\n",bSuccess?"OK":"FAIL");
 #endif
-				}
-				else
-				{
-
-					bError |= 0==Publish(String(prop.GetTopic()+"/$name").c_str(), ipub_qos, true, prop.strFriendlyName.c_str());
-					bError |= 0==Publish(String(prop.GetTopic()+"/$settable").c_str(), ipub_qos, true, prop.GetSettable()?"true":"false");
-					bError |= 0==Publish(String(prop.GetTopic()+"/$retained").c_str(), ipub_qos, true, (prop.GetRetained() || prop.GetFakeRetained())?"true":"false");
-					bError |= 0==Publish(String(prop.GetTopic()+"/$datatype").c_str(), ipub_qos, true, GetHomieDataTypeText((eHomieDataType) prop.datatype));
-					if(prop.pstrUnit && prop.pstrUnit->length())
-					{
-						bError |= 0==Publish(String(prop.GetTopic()+"/$unit").c_str(), ipub_qos, true, prop.pstrUnit->c_str());
-					}
-					if(prop.strFormat.length())
-					{
-						bError |= 0==Publish(String(prop.GetTopic()+"/$format").c_str(), ipub_qos, true, prop.strFormat.c_str());
-					}
+		return bError;
+	}
 
-					if(prop.GetSettable())
-					{
-						mapIncoming[prop.GetTopic()]=&prop;
-						mapIncoming[prop.GetSetTopic()]=&prop;
-						if(prop.GetRetained())
-						{
-	#ifdef HOMIELIB_VERBOSE
-							csprintf("SUBSCRIBING to %s: ",prop.GetTopic().c_str());
-	#endif
-							if(prop.GetReceivedRetained())
-							{
-								bError |= 0==(bSuccess=prop.Publish());
-							}
-							else
-							{
-								bError |= 0==(bSuccess=mqtt.subscribe(prop.GetTopic().c_str(), sub_qos));
-							}
+	if(prop.GetSettable())
+	{
+		if(prop.GetRetained())
+		{
 #ifdef HOMIELIB_VERBOSE
-							csprintf("%s\n",bSuccess?"OK":"FAIL");
+			csprintf("SUBSCRIBING to %s: ",prop.GetTopic().c_str());
 #endif
-						}
-						else
-						{
-							bError |= 0==(bSuccess=prop.Publish());
-						}
-	#ifdef HOMIELIB_VERBOSE
-						csprintf("SUBSCRIBING to %s: ",prop.GetSetTopic().c_str());
-	#endif
-						bError |= 0==(bSuccess=mqtt.subscribe(prop.GetSetTopic().c_str(), sub_qos));
+			if(prop.GetReceivedRetained() || prop.GetChangedOffline())
+			{
+				prop.SetReceivedRetained(true);	//our own value is newer than whatever the broker retained
+				bError |= 0==(bSuccess=prop.Publish());
+			}
+			else
+			{
+				bError |= 0==(bSuccess=mqtt.subscribe(prop.GetTopic().c_str(), prop.GetSubscribeQos()));
+			}
 #ifdef HOMIELIB_VERBOSE
-						csprintf("%s\n",bSuccess?"OK":"FAIL");
+			csprintf("%s\n",bSuccess?"OK":"FAIL");
 #endif
-					}
-					else
-					{
-						if(prop.GetRetained())
-						{
-							bError |= false==prop.Publish();
-						}
-					}
+		}
+		else
+		{
+			bError |= 0==(bSuccess=prop.Publish());
+		}
+#ifdef HOMIELIB_VERBOSE
+		csprintf("SUBSCRIBING to %s: ",prop.GetSetTopic().c_str());
+#endif
+		bError |= 0==(bSuccess=mqtt.subscribe(prop.GetSetTopic().c_str(), prop.GetSubscribeQos()));
+#ifdef HOMIELIB_VERBOSE
+		csprintf("%s\n",bSuccess?"OK":"FAIL");
+#endif
+	}
+	else
+	{
+		if(prop.GetRetained())
+		{
+			bError |= false==prop.Publish();
+		}
+	}
 
-					prop.SetInitialPublishingDone(true);
+	if(!bError) prop.SetInitialPublishingDone(true);
 
+	return bError;
+}
 
+void HomieDevice::BeginBatch()
+{
+	iBatchDepth++;
+}
 
-				}
+void HomieDevice::BeginCoalesce()
+{
+#if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
+	netCoalesce.BeginCoalesce();
+#endif
+}
+
+void HomieDevice::EndCoalesce()
+{
+#if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
+	if(!netCoalesce.EndCoalesce())
+	{
+		csprintf("Socket write failed while coalescing. Reconnecting, coalescing off\n");
+	}
+#endif
+}
 
+void HomieDevice::CommitBatch()
+{
+	if(!iBatchDepth || --iBatchDepth) return;
 
+	BeginCoalesce();
+	for(size_t i=0;i<vecBatch.size();i++)
+	{
+		vecBatch[i]->SetBatched(false);
+		vecBatch[i]->Publish();
+	}
+	EndCoalesce();
 
+	vecBatch.clear();
 
-				if(bError)
-				{
-					HandleInitialPublishingError();
-				}
-				else
-				{
-					iInitialPublishing_Prop++;
-					iPubCount_Props++;
-				}
+	yield();
+}
 
-				return;
-			}
+HomieProperty * HomieDevice::StepProperty(int & iNodeIdx, int & iPropIdx)
+{
+	while(iNodeIdx<(int) vecNode.size())
+	{
+		HomieNode & node=*vecNode[iNodeIdx];
+		if(iPropIdx<(int) node.vecProperty.size())
+		{
+			return node.vecProperty[iPropIdx++];
+		}
+
+		iNodeIdx++;
+		iPropIdx=0;
+	}
+
+	return NULL;
+}
 
-			if(j>=(int) node.vecProperty.size())
+void HomieDevice::FlushChangedOffline()
+{
+	do
+	{
+		HomieProperty * pProp=StepProperty(iFlushNodeIdx,iFlushPropIdx);
+		if(!pProp)
+		{
+			bFlushChangedOffline=false;
+			if(iFlushCount)
 			{
-				iInitialPublishing_Prop=0;
-				iInitialPublishing_Node++;
+				csprintf("Flushed %i values changed while offline\n",iFlushCount);
 			}
+			return;
 		}
 
-		if(iInitialPublishing_Node>=(int) vecNode.size())
+		if(pProp->GetChangedOffline())
 		{
-			iInitialPublishing_Node=0;
-			iInitialPublishing_Prop=0;
-			iInitialPublishing=5;
+			pProp->SetChangedOffline(false);
+			pProp->Publish();
+			iFlushCount++;
 		}
+	} while(HasInflightRoom() && HasLoopBudget());
+}
 
-	}
-
-	if(iInitialPublishing==5)
+void HomieDevice::DoPublishDefaults()
+{
+	do
 	{
-		bool bError=false;
-		bError |= 0==Publish(String(strTopic+"/$state").c_str(), ipub_qos, true, "ready");
-
-		if(bError)
+		HomieProperty * pProp=StepProperty(iPublishDefaultsNodeIdx,iPublishDefaultsPropIdx);
+		if(!pProp)
 		{
-			HandleInitialPublishingError();
+			bDoPublishDefaults=false;
+			return;
 		}
-		else
+
+		pProp->PublishDefault();
+	} while(HasInflightRoom() && HasLoopBudget());
+}
+
+void HomieDevice::DoStats()
+{
+	if(iStatsStage<0)
+	{
+		if((int) (millis()-ulHomieStatsTimestamp)<30000) return;
+		iStatsStage=0;
+		bStatsError=false;
+	}
+
+	//one publish per stage so a small loop budget can spread the burst over several calls
+	do
+	{
+		switch(iStatsStage++)
 		{
-			bDoInitialPublishing=false;
-			csprintf("Initial publishing complete. %i nodes, %i properties\n",vecNode.size(),iPubCount_Props);
-			FinishInitialPublishing(this);
+		case 0:
+			if(bInitialPublishingDone)
+			{
+				if(iRePublishReady<2 || (iRePublishReady & 15)==6)		//re-publish once in a while
+				{
+					bStatsError |= 0==Publish(String(strTopic+"/$state").c_str(), qosAttributes, true, "ready");
+				}
+				iRePublishReady++;
+			}
+			break;
+		case 1:
+			{
+				String strExtensions="org.homie.legacy-stats:0.1.1:[4.x]";
 
-			bInitialPublishingDone=true;
+				if(strFirmwareName.length() || strFirmwareVersion.length())
+				{
+					strExtensions+=",org.homie.legacy-firmware:0.1.1:[4.x]";
+				}
 
-			iRePublishReady=0;
+				bStatsError |= 0==Publish(String(strTopic+"/$extensions").c_str(), qosStats, true, strExtensions.c_str());
+			}
+			break;
+		case 2:
+			if(strFirmwareName.length())
+			{
+				bStatsError |= 0==Publish(String(strTopic+"/$fw/name").c_str(), qosStats, true, strFirmwareName.c_str());
+			}
+			break;
+		case 3:
+			if(strFirmwareVersion.length())
+			{
+				bStatsError |= 0==Publish(String(strTopic+"/$fw/version").c_str(), qosStats, true, strFirmwareVersion.c_str());
+			}
+			break;
+		case 4:
+			bStatsError |= 0==Publish(String(strTopic+"/$stats/uptime").c_str(), qosStats, true, String(ulSecondCounter_Uptime).c_str());
+			break;
+		case 5:
+			bStatsError |= 0==Publish(String(strTopic+"/$stats/uptime-wifi").c_str(), qosStats, true, String(ulSecondCounter_WiFi).c_str());
+			break;
+		case 6:
+#if defined(USE_ETHERNET) & defined(ARDUINO_ARCH_ESP32)
+			bStatsError |= 0==Publish(String(strTopic+"/$stats/uptime-ethernet").c_str(), qosStats, true, String(ulSecondCounter_Ethernet).c_str());
+#endif
+			break;
+		case 7:
+			bStatsError |= 0==Publish(String(strTopic+"/$stats/uptime-mqtt").c_str(), qosStats, true, String(ulSecondCounter_MQTT).c_str());
+			break;
+		case 8:
+			bStatsError |= 0==Publish(String(strTopic+"/$stats/signal").c_str(), qosStats, true, String(WiFi.RSSI()).c_str());
+			break;
+		case 9:
+			bStatsError |= 0==Publish(String(strTopic+"/$stats/freeheap").c_str(), qosStats, true, String(ulFreeHeap).c_str());
+			break;
+		case 10:
+			bStatsError |= 0==Publish(String(strTopic+"/$stats/freeheap_contiguous").c_str(), qosStats, true, String(ulFreeHeapContig).c_str());
+			break;
+		case 11:
+#ifdef HOMIELIB_CONNECT_ASYNC
+			bStatsError |= 0==Publish(String(strTopic+"/$stats/connecttask_stackfree").c_str(), qosStats, true, String(GetConnectTaskStackFree()).c_str());
+#endif
+			break;
+		case 12:
+			ulFreeHeap=0xFFFFFFF;
+#if defined(ARDUINO_ARCH_ESP8266)
+			ulFreeHeapContig=0xFFFF;
+			bStatsError |= 0==Publish(String(strTopic+"/$stats/heapfrag").c_str(), qosStats, true, String(uHeapFrag).c_str());
+			uHeapFrag=0;
+#else
+			ulFreeHeapContig=0xFFFFFFF;
+#endif
+			break;
+		default:
+			iStatsStage=-1;
 
-			ulPublishDefaultsTimestamp=millis()+15000;
-			bDoPublishDefaults=true;
+			if(bStatsError)
+			{
+				ulHomieStatsTimestamp=millis()-(30000-GetErrorRetryFrequency());	//retry in a while
+			}
+			else
+			{
+				ulHomieStatsTimestamp=millis();
+				bTelemetrySent=true;
 
-			ulMqttReconnectCount=0;
+				//devices that reconnected together after a broker restart would otherwise publish in lockstep
+				if(!bStatsPhased) ulHomieStatsTimestamp+=HomiePhaseOffset(ulPhaseSeed,ulStatsSpread_ms);
+				bStatsPhased=true;
+			}
 
+//			csprintf("Periodic publishing: %i, %i, %i\n",pub_return[0],pub_return[1],pub_return[2]);
+			break;
 		}
+	} while(iStatsStage>=0 && HasInflightRoom() && HasLoopBudget());
+}
 
+bool HomieDevice::HasLoopBudget()
+{
+	if(!ulLoopBudget_us || micros()-ulLoopStart_us<ulLoopBudget_us) return true;
 
-	}
-
+	Wake();		//pick up where we left off on the next call
+	return false;
 }
 
 uint16_t HomieDevice::PublishDirect(const String & topic, uint8_t qos, bool retain, const String & payload)
@@ -1109,9 +1872,16 @@ uint16_t HomieDevice::PublishDirectUint8(const char * topic, uint8_t qos, bool r
 	mqtt.publish(topic, qos, retain, (uint8_t *) payload, length, 0);
 	return 1;
 #elif defined(USE_ASYNCMQTTCLIENT)
-	return mqtt.publish(topic, qos, retain, (const char *) payload, length);
+	uint16_t id=mqtt.publish(topic, qos, retain, (const char *) payload, length);
+	if(qos && id) TrackInflight(id);
+	return id;
 #elif defined(USE_ARDUINOMQTT)
-	return pMQTT->publish(topic, payload, retain, qos)==true;
+	if(!qos) return pMQTT->publish(topic, (const char *) payload, (int) length, retain, qos)==true;
+
+	unsigned long ulSent=millis();
+	bool bAcked=pMQTT->publish(topic, (const char *) payload, (int) length, retain, qos);	//waits for the acknowledgement
+	if(bAcked) AddAckLatency(millis()-ulSent);
+	return bAcked;
 #elif defined(USE_PUBSUBCLIENT)
 	(void)(qos);
 	return pMQTT->publish(topic, payload, length, retain);
@@ -1119,6 +1889,98 @@ uint16_t HomieDevice::PublishDirectUint8(const char * topic, uint8_t qos, bool r
 
 }
 
+size_t HomieDevice::GetMaxPayload(size_t topic_len, uint8_t qos)
+{
+	//fixed header of up to 5 bytes, topic length, topic and the packet id for QoS 1/2
+	size_t overhead=5+2+topic_len+(qos?2:0);
+#if defined(USE_ARDUINOMQTT)
+	return ARDUINOMQTT_BUFSIZE>overhead?ARDUINOMQTT_BUFSIZE-overhead:0;
+#elif defined(USE_PUBSUBCLIENT)
+	return MQTT_MAX_PACKET_SIZE>overhead?MQTT_MAX_PACKET_SIZE-overhead:0;
+#else
+	(void)(overhead);
+	return 0xFFFF;	//copied into the TCP send buffer in pieces
+#endif
+}
+
+const unsigned long HomieAckBucket_ms[HOMIELIB_ACK_BUCKETS]={10,25,50,100,250,500,1000,2500,0xFFFFFFFF};
+
+void HomieDevice::TrackInflight(uint16_t id)
+{
+	for(int i=0;i<HOMIELIB_INFLIGHT_MAX;i++)
+	{
+		if(inflight[i].id) continue;
+
+		//stamped before the claim since the ack may come from another task right after it.
+		//a racing claimer that loses the slot only ever writes the current time too
+		inflight[i].ulSent_ms=millis();
+		uint16_t expected=0;
+		if(inflight[i].id.compare_exchange_strong(expected,id))
+		{
+			iInflight++;
+			return;
+		}
+	}
+
+	ulInflightUntracked++;
+}
+
+void HomieDevice::onPublishAck(uint16_t id)
+{
+	for(int i=0;i<HOMIELIB_INFLIGHT_MAX;i++)
+	{
+		if(inflight[i].id==id)
+		{
+			unsigned long ulSent_ms=inflight[i].ulSent_ms;
+			uint16_t expected=id;
+			if(!inflight[i].id.compare_exchange_strong(expected,0)) return;	//expired by Loop meanwhile
+			AddAckLatency(millis()-ulSent_ms);
+			iInflight--;
+			if(GetInflightWindow()) Wake();	//bulk publishing may be waiting for room
+			return;
+		}
+	}
+}
+
+void HomieDevice::AddAckLatency(unsigned long ulLatency_ms)
+{
+	int b=0;
+	while(ulLatency_ms>HomieAckBucket_ms[b]) b++;
+	ulAckLatency[b]++;
+
+	if(ulLatency_ms>ulAckLatencyMax_ms) ulAckLatencyMax_ms=ulLatency_ms;
+}
+
+void HomieDevice::ResetAckLatency()
+{
+	for(int b=0;b<HOMIELIB_ACK_BUCKETS;b++) ulAckLatency[b]=0;
+	ulAckLatencyMax_ms=0;
+	ulInflightUntracked=0;
+}
+
+void HomieDevice::ExpireInflight()
+{
+	//an ack that came in before the publish was tracked, or one the broker never sent, mustn't hold the window forever
+	for(int i=0;i<HOMIELIB_INFLIGHT_MAX;i++)
+	{
+		uint16_t id=inflight[i].id;
+		if(id && millis()-inflight[i].ulSent_ms>HOMIELIB_INFLIGHT_TIMEOUT_MS && inflight[i].id.compare_exchange_strong(id,0))
+		{
+			iInflight--;
+			ulInflightExpired++;
+		}
+	}
+}
+
+void HomieDevice::ClearInflight()
+{
+	//acks for the old connection won't come
+	for(int i=0;i<HOMIELIB_INFLIGHT_MAX;i++)
+	{
+		if(inflight[i].id.exchange(0)) iInflight--;	//a late ack may race us for the slot
+	}
+}
+
 bool bFailPublish=false;
 
 uint16_t HomieDevice::Publish(const char* topic, uint8_t qos, bool retain, const char* payload, size_t length, bool dup, uint16_t message_id)
@@ -1244,66 +2106,6 @@ String HomieDeviceName(const char * in)
 	return ret;
 }
 
-bool HomieParseRGB(const char * in, uint32_t & rgb)
-{
-	int r, g, b;
-
-	if (sscanf(in, "%d,%d,%d", &r, &g, &b) == 3)
-	{
-		rgb=(r<<16) + (g<<8) + (b<<0);
-		return true;
-	}
-	return false;
-}
-
-
-void HSVtoRGB(float fHueIn, float fSatIn, float fBriteIn, float & fRedOut, float & fGreenOut, float & fBlueOut)
-{
-	float fHue = (float) fmod(fHueIn / 6.0f, 60);
-	float fC = fBriteIn * fSatIn;
-	float fL = fBriteIn - fC;
-	float fX = (float) (fC * (1.0f - fabs(fmod(fHue * 0.1f, 2.0f) - 1.0f)));
-
-	if(fHue >= 0.0f && fHue < 10.0f) { fRedOut = fC; fGreenOut = fX; fBlueOut = 0; }
-	else if(fHue >= 10.0f && fHue < 20.0f) { fRedOut = fX; fGreenOut = fC; fBlueOut = 0; }
-	else if(fHue >= 20.0f && fHue < 30.0f) { fRedOut = 0; fGreenOut = fC; fBlueOut = fX; }
-	else if(fHue >= 30.0f && fHue < 40.0f) { fRedOut = 0; fGreenOut = fX; fBlueOut = fC; }
-	else if(fHue >= 40.0f && fHue < 50.0f) { fRedOut = fX; fGreenOut = 0; fBlueOut = fC; }
-	else if(fHue >= 50.0f && fHue < 60.0f) { fRedOut = fC; fGreenOut = 0; fBlueOut = fX; }
-	else { fRedOut = 0; fGreenOut = 0; fBlueOut = 0; }
-
-	fRedOut += fL;
-	fGreenOut += fL;
-	fBlueOut += fL;
-}
-
-
-bool HomieParseHSV(const char * in, uint32_t & rgb)
-{
-	float h, s, v;
-
-	if (sscanf(in, "%f,%f,%f", &h, &s, &v) == 3)
-	{
-		float fR, fG, fB;
-
-		HSVtoRGB(h, s*0.01f, v*0.01f,fR, fG, fB);
-
-		int r=fR*256.0f;
-		int g=fG*256.0f;
-		int b=fB*256.0f;
-
-		if(r>255) r=255;
-		if(g>255) g=255;
-		if(b>255) b=255;
-
-		rgb=(r<<16) + (g<<8) + (b<<0);
-		return true;
-	}
-
-	return false;
-}
-
-
 int HomieDevice::GetErrorRetryFrequency()
 {
 	int iErrorDuration=(int) (millis()-ulSendErrorTimestamp);
@@ -1338,12 +2140,12 @@ uint32_t HomieDevice::GetUptimeSeconds_Ethernet()
 
 unsigned long HomieDevice::GetReconnectInterval()
 {
-	unsigned long interval=5000;
-	if(ulMqttReconnectCount>=20) interval=60000;
-	else if(ulMqttReconnectCount>=15) interval=30000;
-	else if(ulMqttReconnectCount>=10) interval=20000;
-	else if(ulMqttReconnectCount>=5) interval=10000;
-	return interval;
+	return ulReconnectInterval;
+}
+
+void HomieDevice::NextReconnectInterval()
+{
+	ulReconnectInterval=HomieJitter_ms(HomieBackoff_ms(ulMqttReconnectCount,ulReconnectMin_ms,ulReconnectMax_ms),HomieRandom());
 }
 
 void HomieDevice::InitialUnsubscribe(HomieProperty * pProp)
@@ -14,6 +14,11 @@
 #include <list>
 #endif
 #include "HomieNode.h"
+#include "HomieQueue.h"
+#include "HomieClient.h"
+#include "HomieColor.h"
+#include "HomieSchedule.h"
+#include "HomieWorker.h"
 #include <map>
 
 #if defined(ARDUINO_ARCH_ESP8266)
@@ -22,8 +27,8 @@
 #include "WiFi.h"
 #endif
 
-#if defined(ARDUINO_ARCH_ESP32) && defined(USE_PUBSUBCLIENT)
-#define HOMIELIB_CONNECT_ASYNC
+#if defined(ARDUINO_ARCH_ESP32) && (defined(USE_PUBSUBCLIENT) || defined(USE_ARDUINOMQTT))
+#define HOMIELIB_CONNECT_ASYNC	//connect from a separate task. elsewhere, or if the task can't be created, the connect is split into bounded steps
 #endif
 
 
@@ -35,15 +40,66 @@ typedef std::function<bool(const char* topic, uint8_t * payload, size_t length)>
 
 typedef std::map<String, HomieProperty *> _map_incoming;
 
+struct HomieInflight
+{
+	std::atomic<uint16_t> id{0};	//0 is a free slot
+	std::atomic<unsigned long> ulSent_ms{0};
+};
+
+#define HOMIELIB_ACK_BUCKETS 9
+extern const unsigned long HomieAckBucket_ms[HOMIELIB_ACK_BUCKETS];	//upper bounds of the ack latency histogram buckets, the last is open ended
+
+struct HomieRoute
+{
+	uint32_t uTopicOffset;	//into HomieDevice::vecRouteTopics
+	HomieProperty * pProp;
+};
+
+enum eHomiePostType
+{
+	homiePostInt,
+	homiePostFloat,
+	homiePostBool,
+	homiePostString,
+};
+
+struct HomiePostedValue
+{
+	HomieProperty * pProp;
+	uint8_t type;	/* eHomiePostType */
+	int8_t decimals;
+	union
+	{
+		int32_t iValue;
+		float fValue;
+		bool bValue;
+		char szValue[HOMIELIB_POST_STRING_MAX];
+	};
+};
+
+struct HomiePostedPublish
+{
+	char szTopic[HOMIELIB_INBOUND_TOPIC_MAX];
+	uint8_t payload[HOMIELIB_POST_PAYLOAD_MAX];
+	uint16_t length;
+	uint8_t qos;
+	bool retain;
+};
+
+struct HomieIncomingMessage
+{
+	HomieProperty * pProp;	//resolved by the transport callback
+	char szTopic[HOMIELIB_INBOUND_TOPIC_MAX];
+	uint8_t payload[HOMIELIB_INBOUND_PAYLOAD_MAX];
+	uint16_t length;
+};
+
 typedef std::function<void(const char * szText)> HomieDebugPrintCallback;
 
 void HomieLibRegisterDebugPrintCallback(HomieDebugPrintCallback cb);
 
 String HomieDeviceName(const char * in);
 
-bool HomieParseRGB(const char * in, uint32_t & rgb);
-bool HomieParseHSV(const char * in, uint32_t & rgb);
-
 
 class HomieDevice
 {
@@ -53,8 +109,33 @@ public:
 	virtual ~HomieDevice();
 	
 	bool bDebug=false;
-	int iMainLoopInterval_ms=100;
+	int iMainLoopInterval_ms=100;	//polling interval for the link and the transport, and for retrying work the transport refused
 	int iInitialPublishingThrottle_ms=200;
+	int iInitialPublishingBurst=4;	//properties per step while publishing values and subscribing to /set after a connect
+
+	//QoS per kind of message. HomieProperty::SetPublishQos/SetSubscribeQos override them per property
+	uint8_t qosAttributes=1;	//$state and the device, node and property attributes
+	uint8_t qosValues=1;		//property values and JSON
+	uint8_t qosStats=2;			//$stats, $fw and $extensions
+#if defined(USE_PUBSUBCLIENT)
+	uint8_t qosSubscriptions=1;	//PubSubClient subscribes at 0 or 1 only
+#else
+	uint8_t qosSubscriptions=2;	//base topics of retained settable properties, /set topics and plain subscriptions
+#endif
+	int iPublishQueueSize=16;	//property values that failed to publish are retried from this queue. set before Init()
+	int iIncomingQueueSize=0;	//if nonzero, incoming messages are copied into a ring of this size by the transport and handled from Loop. set before Init()
+	int iPostQueueSize=0;	//if nonzero, HomieProperty::Post* go through a lock-free queue drained by Loop and may be called from any task. set before Init()
+	int iPostDirectQueueSize=0;	//same for PostDirect. set before Init()
+	unsigned long ulReconnectMin_ms=5000;	//reconnect backoff doubles from this up to ulReconnectMax_ms, randomized by up to half
+	unsigned long ulReconnectMax_ms=60000;
+	unsigned long ulConnectTimeout_ms=20000;	//abandon a connect attempt that hasn't succeeded or failed after this long
+	unsigned long ulConnectStepTimeout_ms=2000;	//ArduinoMQTT/PubSubClient: socket and handshake timeouts, the most a connect step can block Loop
+	int iInflightWindow=0;	//if nonzero, bulk publishing waits while this many QoS 1/2 publishes are unacknowledged. at most HOMIELIB_INFLIGHT_MAX. AsyncMqttClient only, the others keep the throttle
+	unsigned long ulLoopBudget_us=0;	//if nonzero, Loop stops starting new work after this long and resumes on the next call
+	int iCoalesceBufferSize=0;	//ArduinoMQTT/PubSubClient: if nonzero, writes during bulk publishing are gathered into socket writes of up to this many bytes. 1400 fills a segment. ArduinoMQTT waits for the ack of each QoS 1/2 publish, which sends it alone, so there it only helps at QoS 0. set before Init()
+	unsigned long ulRefreshInterval_ms=0;	//if nonzero, fake retained values are republished this often, spread over the interval by a hash of the topic. set before Init()
+	bool bRefreshAll=false;	//refresh all values, not just fake retained ones. set before Init()
+	unsigned long ulStatsSpread_ms=30000;	//after the first $stats of a connection the 30s cadence is shifted by a per-device amount below this
 
 	String strFirmwareName;
 	String strFirmwareVersion;
@@ -77,23 +158,65 @@ public:
 	void Init();
 	void Quit();
 
-	void Loop();
+	unsigned long Loop();	//returns the number of ms until Loop has something to do. calling it earlier is cheap
+
+	unsigned long GetNextLoopDelay();
+	void Wake() { bWake=true; }	//new work is pending, have the next Loop call run right away
 
 	HomieNode * NewNode();
 
 	std::vector<HomieNode *> vecNode;
 
 
-	HomieProperty * NewSubscription(const String & strTopic);	//to create a LeifSimpleMQTT-compatible mqtt subscription object
+	HomieProperty * NewSubscription(const String & strTopic);	//to create a LeifSimpleMQTT-compatible mqtt subscription object. after Init it takes effect from the next connect
 
 
 	bool IsConnected();
 	bool IsConnecting() { return bConnecting; };
 
 	bool IsReady();
+	bool IsCommandsReady() { return IsConnected() && bCommandsReady; }	//all /set topics subscribed and values published, attributes may still be pending
+	unsigned long GetCommandsReady_ms() { return ulCommandsReady_ms; }	//from the start of the last connect attempt
 
 	uint16_t PublishDirect(const String & topic, uint8_t qos, bool retain, const String & payload);
 	uint16_t PublishDirectUint8(const char * topic, uint8_t qos, bool retain, const uint8_t * payload, uint32_t length);
+	size_t GetMaxPayload(size_t topic_len, uint8_t qos);	//largest payload the transport can send in one publish, limited by its packet buffer
+
+	//defer property publishes until CommitBatch, then send them back to back. calls may nest.
+	void BeginBatch();
+	void CommitBatch();
+
+	int GetPublishQueueDepth() { return iPublishQueueCount; }
+	int GetPublishQueueHighWater() { return iPublishQueueHighWater; }
+	uint32_t GetPublishQueueOverflows() { return ulPublishQueueOverflows; }
+
+	//PublishDirectUint8 from any task, sent by Loop. without iPostDirectQueueSize it publishes right away and is no safer than PublishDirectUint8
+	bool PostDirect(const char * topic, uint8_t qos, bool retain, const uint8_t * payload, uint32_t length);
+
+	int GetPostQueueDepth() { return ringPost.Count(); }
+	uint32_t GetPostQueueOverflows() { return ulPostOverflows; }
+
+	uint32_t GetReconnectAttempts() { return ulReconnectAttempts; }
+	uint32_t GetConnectTimeouts() { return ulConnectTimeouts; }
+	unsigned long GetLastTimeToConnect_ms() { return ulLastTimeToConnect_ms; }	//from the first attempt after losing the connection
+	unsigned long GetMaxTimeToConnect_ms() { return ulMaxTimeToConnect_ms; }
+
+	int GetInflightCount() { return iInflight; }
+	const uint32_t * GetAckLatencyHistogram() { return ulAckLatency; }	//HOMIELIB_ACK_BUCKETS counts, see HomieAckBucket_ms
+	unsigned long GetAckLatencyMax_ms() { return ulAckLatencyMax_ms; }
+	uint32_t GetInflightUntracked() { return ulInflightUntracked; }	//publishes sent while every slot was taken
+	uint32_t GetInflightExpired() { return ulInflightExpired; }	//tracked publishes that saw no ack within HOMIELIB_INFLIGHT_TIMEOUT_MS
+	void ResetAckLatency();
+
+	uint32_t GetRefreshCount() { return ulRefreshCount; }	//values republished by the refresh scheduler
+
+	unsigned long GetLoopMaxDuration_us() { return ulLoopMaxDuration_us; }
+	uint32_t GetLoopOverruns() { return ulLoopOverruns; }	//Loop calls that took longer than ulLoopBudget_us
+	void ResetLoopStats() { ulLoopMaxDuration_us=0; ulLoopOverruns=0; }
+
+	int GetIncomingQueueDepth() { return ringIncoming.Count(); }
+	uint32_t GetIncomingQueueOverflows() { return ulIncomingOverflows; }
+	uint32_t GetIncomingQueueOversize() { return ulIncomingOversize; }
 
 #if defined(USE_PANGOLIN)
 	PangolinMQTT mqtt;
@@ -102,14 +225,32 @@ public:
 #elif defined(USE_ARDUINOMQTT)
 	MQTTClient * pMQTT=NULL;
 	WiFiClient net;
+	HomieCoalescingClient netCoalesce{net};
 #elif defined(USE_PUBSUBCLIENT)
 	PubSubClient * pMQTT=NULL;
 	WiFiClient net;
+	HomieCoalescingClient netCoalesce{net};
+#endif
+
+	//with iCoalesceBufferSize set, publishes between these go out in as few socket writes as possible. calls may nest.
+	//only ArduinoMQTT and PubSubClient write through a Client we can wrap, elsewhere they do nothing
+	void BeginCoalesce();
+	void EndCoalesce();
+
+#if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
+	uint32_t GetNetWrites() { return netCoalesce.GetWrites(); }
+	uint32_t GetNetWriteCalls() { return netCoalesce.GetWriteCalls(); }
+	uint32_t GetNetBytes() { return netCoalesce.GetBytes(); }
+	uint32_t GetNetFlushFailures() { return netCoalesce.GetFlushFailures(); }	//each one dropped the connection and turned coalescing off
 #endif
 
 #ifdef HOMIELIB_CONNECT_ASYNC
-	bool bDoConnect=false;
-	TaskHandle_t hTaskConnect;
+	int iConnectTaskStackSize=6144;	//bytes. check GetConnectTaskStackFree() when changing it. set before Init()
+	uint32_t GetConnectTaskStackFree() { return workerConnect.GetStackFree(); }	//least free stack seen
+
+	volatile bool bDoConnect=false;
+	HomieWorker workerConnect;	//if it can't be created the connect runs in bounded steps from Loop, as on other platforms
+	bool StartConnectTask();
 	void TaskConnect();
 #endif
 
@@ -129,7 +270,7 @@ public:
 #endif
 
 	bool GetEnableMQTT();
-	void SetEnableMQTT(bool bEnable) { this->bEnableMQTT=bEnable; }
+	void SetEnableMQTT(bool bEnable) { this->bEnableMQTT=bEnable; Wake(); }
 
 #if defined(USE_PANGOLIN)
 	const char * GetMqttLibraryID() { return "LeifHomieLib/PangolinMQTT"; }
@@ -180,6 +321,16 @@ private:
 	void onMqttMessage(char* topic, byte* payload, unsigned int len);
 #endif
 
+#if defined(USE_PANGOLIN)
+	void HandleMessage(HomieProperty * pProp, const char* topic, uint8_t * payload, PANGO_PROPS & properties, size_t len, size_t index, size_t total);
+#elif defined(USE_ASYNCMQTTCLIENT)
+	void HandleMessage(HomieProperty * pProp, char* topic, char* payload, AsyncMqttClientMessageProperties & properties, size_t len, size_t index, size_t total);
+#elif defined(USE_ARDUINOMQTT)
+	void HandleMessage(HomieProperty * pProp, char* topic, char* payload, void * properties, size_t len, size_t index, size_t total);
+#elif defined(USE_PUBSUBCLIENT)
+	void HandleMessage(HomieProperty * pProp, char* topic, byte* payload, void * properties, unsigned int len, int index, int total);
+#endif
+
 	void DoDisconnect();
 
 	bool bConnecting=false;
@@ -187,6 +338,13 @@ private:
 	bool bDoInitialPublishing=false;
 
 	bool bInitialPublishingDone=false;
+	bool bWasReady=false;	//reached $state ready at least once. values set after this are flushed on reconnect
+
+	void FlushChangedOffline();
+	bool bFlushChangedOffline=false;
+	int iFlushNodeIdx=0;
+	int iFlushPropIdx=0;
+	int iFlushCount=0;
 
 	int iInitialPublishing=0;
 	int iInitialPublishing_Node=0;
@@ -198,6 +356,33 @@ private:
 
 	unsigned long ulInitialPublishing=0;
 
+	void QueuePublish(HomieProperty * pProp);
+	void DoPublishQueue();
+	std::vector<HomieProperty *> vecPublishQueue;
+	int iPublishQueueHead=0;
+	int iPublishQueueCount=0;
+	int iPublishQueueHighWater=0;
+	uint32_t ulPublishQueueOverflows=0;
+
+	int iBatchDepth=0;
+	std::vector<HomieProperty *> vecBatch;
+
+	std::vector<HomieStreamProperty *> vecStream;
+
+	std::vector<HomieProperty *> vecLimited;	//properties with publish rate control or /set coalescing
+
+	HomieMpscRing<HomiePostedValue> ringPost;
+	HomieMpscRing<HomiePostedPublish> ringPostDirect;
+	bool PostValue(const HomiePostedValue & value);
+	void DoPostQueue();
+	std::atomic<uint32_t> ulPostOverflows{0};
+
+	HomieSpscRing<HomieIncomingMessage> ringIncoming;
+	bool QueueIncoming(HomieProperty * pProp, const char * topic, const uint8_t * payload, size_t len, size_t index);
+	void DoIncomingQueue();
+	std::atomic<uint32_t> ulIncomingOverflows{0};
+	std::atomic<uint32_t> ulIncomingOversize{0};
+
 	void DoLazyPublishing();
 	unsigned long ulLazyPublishing=0;
 	int iLazyPublishingNodeIdx=0;
@@ -210,7 +395,32 @@ private:
 	String strTopic;
 	char szWillTopic[128];
 
-	_map_incoming mapIncoming;
+	//incoming topics sorted by strcmp. only built while disconnected, so the transport can look up from its own task
+	std::vector<HomieRoute> vecRoutes;
+	std::vector<char> vecRouteTopics;
+	bool bRoutesDirty=false;	//NewSubscription after Init, taken in by Loop before the next connect attempt
+	std::vector<HomieProperty *> vecNewSubscriptions;
+	void AddNewSubscriptions();
+	void BuildRoutes();
+	HomieProperty * FindRoute(const char * topic);
+
+	std::vector<HomieProperty *> vecAllProperties;
+
+	//properties to refresh grouped by slot, slot i is vecRefresh[uRefreshSlotStart[i]] up to uRefreshSlotStart[i+1]
+	std::vector<HomieProperty *> vecRefresh;
+	uint16_t uRefreshSlotStart[HOMIELIB_REFRESH_SLOTS+1];
+	void BuildRefreshSlots();
+	void DoRefresh();
+	unsigned long GetRefreshSlot_ms() { return max(ulRefreshInterval_ms/HOMIELIB_REFRESH_SLOTS,1UL); }
+	int iRefreshSlot=0;
+	unsigned long ulRefreshTimestamp=0;
+	uint32_t ulRefreshCount=0;
+	std::vector<HomieProperty *> vecInitialOrder;	//SetPriority properties first
+	void BuildInitialOrder();
+
+	bool InitialPublishValue(HomieProperty & prop);	//true on error
+	bool bCommandsReady=false;
+	unsigned long ulCommandsReady_ms=0;
 
 	_map_incoming mapPlainSubscriptions;
 
@@ -223,11 +433,52 @@ private:
 #endif
 
 	unsigned long ulLastLoopSecondCounterTimestamp=0;
-	unsigned long ulLastLoopTimestamp=0;
+	unsigned long ulNextLoop=0;
+	std::atomic<bool> bWake{true};
+	int iLazyPending=0;		//properties with NeedsPublish set
+
+	void DoLoop();
+	bool HasImmediateWork();	//queued work the next pass can actually get done
+	bool bTransportBusy=false;	//the transport refused something on the last pass, retry at the polling interval
 
 
 	bool bDoPublishDefaults=false;	//publish default retained values that did not yet exist in the controller
 	unsigned long ulPublishDefaultsTimestamp=0;
+	void DoPublishDefaults();
+	int iPublishDefaultsNodeIdx=0;
+	int iPublishDefaultsPropIdx=0;
+
+	HomieProperty * StepProperty(int & iNodeIdx, int & iPropIdx);	//resumable walk over all properties, NULL at the end
+
+	void DoStats();
+	int iStatsStage=-1;
+	bool bStatsError=false;
+	bool bStatsPhased=false;
+
+	uint32_t ulPhaseSeed=0;	//hash of strID and the MAC, phases periodic work apart across a fleet
+
+	HomieInflight inflight[HOMIELIB_INFLIGHT_MAX];
+	std::atomic<int> iInflight{0};
+	uint32_t ulAckLatency[HOMIELIB_ACK_BUCKETS]={};
+	unsigned long ulAckLatencyMax_ms=0;
+	uint32_t ulInflightUntracked=0;
+	void TrackInflight(uint16_t id);
+	void onPublishAck(uint16_t id);
+	void AddAckLatency(unsigned long ulLatency_ms);
+	void ClearInflight();
+	void ExpireInflight();
+	uint32_t ulInflightExpired=0;
+	bool HasInflightRoom() { return !GetInflightWindow() || iInflight<GetInflightWindow(); }
+#if defined(USE_ASYNCMQTTCLIENT)
+	int GetInflightWindow() { return iInflightWindow; }
+#else
+	int GetInflightWindow() { return 0; }
+#endif
+
+	bool HasLoopBudget();
+	unsigned long ulLoopStart_us=0;
+	unsigned long ulLoopMaxDuration_us=0;
+	uint32_t ulLoopOverruns=0;
 
 	void HandleInitialPublishingError();
 
@@ -237,9 +488,30 @@ private:
 	int GetErrorRetryFrequency();
 
 	unsigned long GetReconnectInterval();
+	void NextReconnectInterval();
+	unsigned long ulReconnectInterval=0;
+	uint32_t ulReconnectAttempts=0;
+	uint32_t ulConnectTimeouts=0;
+	unsigned long ulOutageStart=0;
+	unsigned long ulLastTimeToConnect_ms=0;
+	unsigned long ulMaxTimeToConnect_ms=0;
+	bool bLinkUp=false;
 
 #if defined(USE_ARDUINOMQTT) | defined(USE_PUBSUBCLIENT)
 	std::list<HomieProperty *> listUnsubQueue;
+
+	bool ConnectSession(bool bSocketOpen);	//the MQTT handshake, after the socket connect unless bSocketOpen
+	bool bConnectSession=false;
 #endif
 
 };
+
+class HomieBatch	//BeginBatch/CommitBatch for the lifetime of the object
+{
+public:
+	HomieBatch(HomieDevice & device) : device(device) { device.BeginBatch(); }
+	~HomieBatch() { device.CommitBatch(); }
+
+private:
+	HomieDevice & device;
+};
@@ -0,0 +1,167 @@
+#include "HomieFormat.h"
+#include <string.h>
+#include <stdio.h>
+
+static const double dPow10[]={1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+
+static int HomieFormatUint64(char * szOut, size_t size, uint64_t value, bool bNegative, int iMinDigits)
+{
+	char szTemp[24];
+	int count=0;
+	do
+	{
+		szTemp[count++]='0'+(char) (value % 10);
+		value/=10;
+	} while(value || count<iMinDigits);
+
+	int length=count+(bNegative?1:0);
+	if((size_t) length>=size) return -1;
+
+	char * p=szOut;
+	if(bNegative) *p++='-';
+	while(count) *p++=szTemp[--count];
+	*p=0;
+
+	return length;
+}
+
+int HomieFormatInt(char * szOut, size_t size, int32_t value)
+{
+	bool bNegative=value<0;
+	uint64_t magnitude=bNegative?(uint64_t) -(int64_t) value:(uint64_t) value;
+	return HomieFormatUint64(szOut,size,magnitude,bNegative,1);
+}
+
+int HomieFormatFloat(char * szOut, size_t size, double value, int decimals)
+{
+	if(decimals<0) decimals=0;
+	if(decimals>9) decimals=9;
+
+	if(value!=value || value-value!=0) return -1;	//NaN or infinite
+
+	bool bNegative=value<0;
+	if(bNegative) value=-value;
+
+	double scaled=value*dPow10[decimals]+0.5;
+	if(!(scaled<1.8e19))
+	{
+		//too large for the integer path
+		int ret=snprintf(szOut,size,"%.*f",decimals,bNegative?-value:value);
+		return (ret>=0 && (size_t) ret<size)?ret:-1;
+	}
+
+	uint64_t fixed=(uint64_t) scaled;
+	if(!fixed) bNegative=false;	//no "-0.00"
+
+	int length=HomieFormatUint64(szOut,size,fixed,bNegative,decimals+1);
+	if(length<0 || !decimals) return length;
+
+	if((size_t) length+1>=size) return -1;
+
+	//make room for the decimal point
+	memmove(szOut+length-decimals+1,szOut+length-decimals,decimals+1);
+	szOut[length-decimals]='.';
+	return length+1;
+}
+
+int HomieFormatSamplesCsv(char * szOut, size_t size, const int16_t * samples, int count, int & length)
+{
+	length=0;
+	if(!size) return 0;
+	szOut[0]=0;
+
+	int i;
+	for(i=0;i<count;i++)
+	{
+		char szTemp[8];
+		int ret=HomieFormatInt(szTemp,sizeof(szTemp),samples[i]);
+		int need=ret+(i?1:0);
+		if(ret<0 || (size_t) (length+need)>=size) break;
+		if(i) szOut[length++]=',';
+		memcpy(szOut+length,szTemp,ret+1);
+		length+=ret;
+	}
+
+	return i;
+}
+
+bool HomieParseInt(const char * in, size_t len, int32_t & value)
+{
+	const char * end=in+len;
+	bool bNegative=false;
+
+	if(in<end && (*in=='-' || *in=='+')) bNegative=*in++=='-';
+	if(in>=end) return false;
+
+	uint32_t limit=bNegative?0x80000000u:0x7FFFFFFFu;
+	uint32_t accumulator=0;
+
+	while(in<end)
+	{
+		unsigned digit=(unsigned) (*in++-'0');
+		if(digit>9) return false;
+		if(accumulator>(limit-digit)/10) return false;	//overflow
+		accumulator=accumulator*10+digit;
+	}
+
+	value=bNegative?(int32_t) (0u-accumulator):(int32_t) accumulator;
+	return true;
+}
+
+bool HomieParseFloat(const char * in, size_t len, double & value)
+{
+	const char * end=in+len;
+	bool bNegative=false;
+
+	if(in<end && (*in=='-' || *in=='+')) bNegative=*in++=='-';
+
+	uint64_t mantissa=0;
+	int exponent=0;
+	int digits=0;
+
+	while(in<end && (unsigned) (*in-'0')<=9)
+	{
+		if(mantissa<100000000000000000ull) mantissa=mantissa*10+(*in-'0');
+		else exponent++;	//beyond double precision anyway
+		in++;
+		digits++;
+	}
+
+	if(in<end && *in=='.')
+	{
+		in++;
+		while(in<end && (unsigned) (*in-'0')<=9)
+		{
+			if(mantissa<100000000000000000ull)
+			{
+				mantissa=mantissa*10+(*in-'0');
+				exponent--;
+			}
+			in++;
+			digits++;
+		}
+	}
+
+	if(!digits) return false;
+
+	if(in<end && (*in=='e' || *in=='E'))
+	{
+		int32_t e;
+		if(!HomieParseInt(in+1,end-in-1,e) || e<-400 || e>400) return false;
+		exponent+=e;
+		in=end;
+	}
+
+	if(in!=end) return false;
+
+	double result=(double) mantissa;
+	while(exponent>22) { result*=1e22; exponent-=22; }
+	while(exponent<-22) { result/=1e22; exponent+=22; }
+	if(exponent>=0) result*=dPow10[exponent];
+	else result/=dPow10[-exponent];
+
+	if(result-result!=0) return false;	//overflowed to infinity
+
+	value=bNegative?-result:result;
+	return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+//locale-free number conversion without heap allocation, in the spirit of to_chars/from_chars.
+//the parsers accept exactly one number spanning all of the given characters.
+
+int HomieFormatInt(char * szOut, size_t size, int32_t value);	//returns length, -1 if it doesn't fit
+int HomieFormatFloat(char * szOut, size_t size, double value, int decimals);	//fixed decimals (0-9), rounded. returns length, -1 if it doesn't fit
+
+int HomieFormatSamplesCsv(char * szOut, size_t size, const int16_t * samples, int count, int & length);	//comma separated, as many as fit. returns how many were written
+
+bool HomieParseInt(const char * in, size_t len, int32_t & value);	//false on syntax error or overflow
+bool HomieParseFloat(const char * in, size_t len, double & value);
@@ -1,11 +1,20 @@
 #include "HomieNode.h"
 #include "HomieDevice.h"
+#include "HomieFormat.h"
 #include <string>
+#include <cmath>
 
 void HomieLibDebugPrint(const char * szText);
 
 #define csprintf(...) { char szTemp[256]; snprintf(szTemp,255,__VA_ARGS__); szTemp[255]=0; HomieLibDebugPrint(szTemp); }
 
+static double HomieValueToDouble(const String & strValue)
+{
+	double value=0;
+	HomieParseFloat(strValue.c_str(),strValue.length(),value);
+	return value;
+}
+
 const char * GetHomieDataTypeText(eHomieDataType datatype)
 {
 	switch((eHomieDataType) datatype)
@@ -95,6 +104,11 @@ void HomieProperty::DoCallback()
 	OnCallback();
 #endif
 
+	if(callback.IsSet())
+	{
+		callback.Invoke(this);
+	}
+
 	if(pVecCallback)
 	{
 		for(size_t i=0;i<pVecCallback->size();i++)
@@ -106,6 +120,8 @@ void HomieProperty::DoCallback()
 
 void HomieProperty::AddCallback(HomiePropertyCallback cb)
 {
+	if(!cb || callback.Set(std::move(cb))) return;
+
 	if(!pVecCallback)
 	{
 		pVecCallback=new std::vector<HomiePropertyCallback>;
@@ -113,6 +129,14 @@ void HomieProperty::AddCallback(HomiePropertyCallback cb)
 	pVecCallback->push_back(cb);
 }
 
+void HomieProperty::AddCallback(HomiePropertyCallbackFn fn, void * pContext)
+{
+	if(!callback.Set(fn,pContext))
+	{
+		AddCallback(HomiePropertyCallback([fn, pContext](HomieProperty * pSource) { fn(pSource,pContext); }));
+	}
+}
+
 void HomieProperty::SetUnit(const char * szUnit)
 {
 	if(szUnit && strlen(szUnit))
@@ -203,57 +227,189 @@ bool HomieProperty::Publish()
 	}
 
 
-	bool bRet=false;
-	String strPublish=strValue;
+	if(!strValue.length() && !GetPublishEmptyString()) return true;
 
-	if(!strPublish.length() && !GetPublishEmptyString()) return true;
+	if(GetQueued()) return true;	//already waiting in the outbound queue, the latest value goes out when it drains
 
-	if(!strPublish.length() && !HomieDataTypeAllowsEmpty((eHomieDataType) datatype))
+	if(pParent->pParent->iBatchDepth)
 	{
-		strPublish=GetDefaultForHomieDataType((eHomieDataType) datatype);
-#ifdef HOMIELIB_VERBOSE
-		csprintf("Empty value for %s/%s encountered, substituting default. ",pParent->strID.c_str(),strID.c_str());
-#endif
+		if(!GetBatched())
+		{
+			SetBatched(true);
+			pParent->pParent->vecBatch.push_back(this);
+		}
+		return true;	//published by CommitBatch
 	}
 
 	if(!pParent->pParent->IsConnected())
 	{
 #ifdef HOMIELIB_VERBOSE
-		csprintf("%s can't publish \"%s\" = no conn. heap=%u\n",strFriendlyName.c_str(),strPublish.c_str(),ESP.getFreeHeap());
+		csprintf("%s can't publish \"%s\" = no conn. heap=%u\n",strFriendlyName.c_str(),strValue.c_str(),ESP.getFreeHeap());
 #endif
+		if(pParent->pParent->bWasReady) SetChangedOffline(true);	//flushed after the next $state ready
+		return false;
 	}
-	else
-	{
+
 #ifdef HOMIELIB_VERBOSE
-		csprintf("%s publishing \"%s\"... heap=%u...",strFriendlyName.c_str(),strPublish.c_str(),ESP.getFreeHeap());
+	csprintf("%s publishing \"%s\"... heap=%u...",strFriendlyName.c_str(),strValue.c_str(),ESP.getFreeHeap());
+	uint32_t free_before=ESP.getFreeHeap();
 #endif
 
+	if(!SendValue())
+	{
+		pParent->pParent->QueuePublish(this);
+	}
+
 #ifdef HOMIELIB_VERBOSE
-		uint32_t free_before=ESP.getFreeHeap();
+	uint32_t free_after=ESP.getFreeHeap();
+	csprintf("done. heap used: %i\n",(int32_t) (free_before-free_after));
 #endif
-		pParent->pParent->PublishDirectUint8(GetTopic().c_str(), 1, GetRetained(), (const uint8_t *) strPublish.c_str(),strPublish.length());
-/*
-#if defined(USE_PANGOLIN)
-		pParent->pParent->mqtt.publish(GetTopic().c_str(), 2, GetRetained(), (uint8_t *) strPublish.c_str(), strPublish.length(), 0);
-#elif defined(USE_ASYNCMQTTCLIENT)
-		pParent->pParent->mqtt.publish( GetTopic().c_str(), 0, GetRetained(), strPublish.c_str(), strPublish.length());
-#elif defined(USE_ARDUINOMQTT)
-		pParent->pParent->pMQTT->publish(GetTopic(), strPublish, GetRetained(), 0);
-		//csprintf("publish A %s=%s ret=%i\n",GetTopic().c_str(),strValue.c_str(),ret);
-#elif defined(USE_PUBSUBCLIENT)
-		pParent->pParent->pMQTT->publish(GetTopic().c_str(), (const uint8_t *) strPublish.c_str(), strPublish.length(), GetRetained());
 
-#endif
-*/
+	return true;
+}
 
+uint16_t HomieProperty::SendValue()
+{
+	const char * szPublish=strValue.c_str();
+	size_t length=strValue.length();
+
+	if(!length && !HomieDataTypeAllowsEmpty((eHomieDataType) datatype))
+	{
+		szPublish=GetDefaultForHomieDataType((eHomieDataType) datatype);
+		length=strlen(szPublish);
 #ifdef HOMIELIB_VERBOSE
-		uint32_t free_after=ESP.getFreeHeap();
-		csprintf("done. heap used: %i\n",(int32_t) (free_before-free_after));
+		csprintf("Empty value for %s/%s encountered, substituting default. ",pParent->strID.c_str(),strID.c_str());
 #endif
-		//bRet=0!=
-		bRet=true;
 	}
-	return bRet;
+
+	char szTopic[128];
+	uint16_t ret;
+	if(GetTopic(szTopic,sizeof(szTopic)))
+	{
+		ret=pParent->pParent->PublishDirectUint8(szTopic, GetPublishQos(), GetRetained(), (const uint8_t *) szPublish, length);
+	}
+	else
+	{
+		ret=pParent->pParent->PublishDirectUint8(GetTopic().c_str(), GetPublishQos(), GetRetained(), (const uint8_t *) szPublish, length);
+	}
+	if(ret)
+	{
+		SetChangedOffline(false);
+		if(pLimit)
+		{
+			pLimit->bPending=false;
+			pLimit->bPublished=true;
+			pLimit->ulLastPublish=millis();
+			pLimit->dLastPublished=HomieValueToDouble(strValue);
+		}
+	}
+	return ret;
+}
+
+HomiePublishLimit * HomieProperty::GetLimit()
+{
+	if(!pLimit)
+	{
+		pLimit=new HomiePublishLimit;
+	}
+	return pLimit;
+}
+
+void HomieProperty::SetMinPublishInterval(unsigned long ulInterval_ms)
+{
+	GetLimit()->ulMinInterval_ms=ulInterval_ms;
+}
+
+void HomieProperty::SetMaxPublishInterval(unsigned long ulInterval_ms)
+{
+	GetLimit()->ulMaxInterval_ms=ulInterval_ms;
+}
+
+void HomieProperty::SetDeadband(double dDeadband, bool bRelative)
+{
+	GetLimit()->dDeadband=dDeadband;
+	pLimit->bDeadbandRelative=bRelative;
+}
+
+bool HomieProperty::LimitAllowsPublish()
+{
+	if(!pLimit || !pLimit->bPublished) return true;
+
+	if(pLimit->dDeadband>0 && (datatype==homieInt || datatype==homieFloat))
+	{
+		double dThreshold=pLimit->dDeadband;
+		if(pLimit->bDeadbandRelative) dThreshold*=fabs(pLimit->dLastPublished);
+
+		if(fabs(HomieValueToDouble(strValue)-pLimit->dLastPublished)<dThreshold)
+		{
+			return false;	//within the deadband. the max interval will still refresh it
+		}
+	}
+
+	if(pLimit->ulMinInterval_ms && millis()-pLimit->ulLastPublish<pLimit->ulMinInterval_ms)
+	{
+		pLimit->bPending=true;	//trailing edge, published by DoLimits
+		pParent->pParent->Wake();
+		return false;
+	}
+
+	return true;
+}
+
+void HomieProperty::SetCoalesceSet(bool bEnable, unsigned long ulWindow_ms)
+{
+	GetLimit()->bCoalesce=bEnable;
+	pLimit->ulCoalesceWindow_ms=ulWindow_ms;
+}
+
+bool HomieProperty::CoalesceSet()
+{
+	if(!pLimit || !pLimit->bCoalesce) return false;
+
+	if(!pLimit->bCoalescePending && pLimit->ulCoalesceWindow_ms && millis()-pLimit->ulLastDelivery>=pLimit->ulCoalesceWindow_ms)
+	{
+		pLimit->ulLastDelivery=millis();
+		return false;	//first one in a while, deliver right away
+	}
+
+	pLimit->bCoalescePending=true;
+	pParent->pParent->Wake();
+	return true;
+}
+
+void HomieProperty::DoLimits()
+{
+	if(!pLimit) return;
+
+	if(pLimit->bCoalescePending && millis()-pLimit->ulLastDelivery>=pLimit->ulCoalesceWindow_ms)
+	{
+		pLimit->bCoalescePending=false;
+		pLimit->ulLastDelivery=millis();
+
+		DoCallback();
+
+		if(!GetNoPublishOnSet())
+		{
+			Publish();
+		}
+
+		if(GetClearPayloadAfterCallback())
+		{
+			strValue="";
+		}
+	}
+
+	if(!GetInitialPublishingDone()) return;
+
+	unsigned long ulElapsed=millis()-pLimit->ulLastPublish;
+
+	if((pLimit->bPending && ulElapsed>=pLimit->ulMinInterval_ms) ||
+		(pLimit->ulMaxInterval_ms && ulElapsed>=pLimit->ulMaxInterval_ms))
+	{
+		pLimit->bPending=false;
+		pLimit->ulLastPublish=millis();		//don't retry every loop while disconnected
+		Publish();
+	}
 }
 
 
@@ -262,14 +418,23 @@ void HomieProperty::SetValue(const String & strNewValue)
 #ifdef HOMIELIB_VERBOSE
 	csprintf("%s setvalue \"%s\"...\n",strFriendlyName.c_str(),strNewValue.c_str());
 #endif
-	if(SetValueConstrained(strNewValue))
+	bool bChanged;
+	if(SetValueConstrained(strNewValue,bChanged))
 	{
+		if(bChanged) pParent->SetJsonDirty();
+
+		if(!bChanged && GetSuppressUnchanged()) return;
+
 		if(GetInitialPublishingDone())
 		{
-			Publish();
+			if(LimitAllowsPublish())
+			{
+				Publish();
+			}
 		}
-		else
+		else if(pParent->pParent->bWasReady)
 		{
+			SetChangedOffline(true);
 		}
 	}
 }
@@ -280,16 +445,130 @@ void HomieProperty::SetBool(bool bValue)
 	SetValue(strTemp);
 }
 
+void HomieProperty::SetInt(int32_t iValue)
+{
+	char szTemp[16];
+	HomieFormatInt(szTemp,sizeof(szTemp),iValue);
+	SetValue(szTemp);
+}
+
+void HomieProperty::SetFloat(double fValue, int decimals)
+{
+	if(decimals<0) decimals=this->decimals>=0?this->decimals:2;
+
+	char szTemp[32];
+	if(HomieFormatFloat(szTemp,sizeof(szTemp),fValue,decimals)>0)
+	{
+		SetValue(szTemp);
+	}
+}
+
+uint32_t HomieProperty::GetColorRGB()
+{
+	uint32_t rgb=0;
+	if(strFormat=="rgb") HomieParseRGB(strValue.c_str(),rgb);
+	else if(strFormat=="hsv") HomieParseHSV(strValue.c_str(),rgb);
+	return rgb;
+}
+
+void HomieProperty::SetColorRGB(uint32_t rgb)
+{
+	if(strFormat=="hsv")
+	{
+		SetColorHSV(HomieRGBtoHSV(rgb));
+		return;
+	}
+
+	char szTemp[16];
+	if(HomieFormatRGB(szTemp,sizeof(szTemp),rgb)>0) SetValue(szTemp);
+}
+
+void HomieProperty::SetColorHSV(uint32_t hsv)
+{
+	if(strFormat!="hsv")
+	{
+		uint32_t rgb;
+		HomieHSVtoRGB(&hsv,&rgb,1);
+		SetColorRGB(rgb);
+		return;
+	}
+
+	char szTemp[24];
+	if(HomieFormatHSV(szTemp,sizeof(szTemp),hsv)>0) SetValue(szTemp);
+}
+
+bool HomieProperty::PostInt(int32_t iValue)
+{
+	if(!pParent->pParent->ringPost.IsEnabled())
+	{
+		SetInt(iValue);
+		return true;
+	}
+
+	HomiePostedValue value;
+	value.pProp=this;
+	value.type=homiePostInt;
+	value.iValue=iValue;
+	return pParent->pParent->PostValue(value);
+}
+
+bool HomieProperty::PostFloat(float fValue, int8_t decimals)
+{
+	if(!pParent->pParent->ringPost.IsEnabled())
+	{
+		SetFloat(fValue,decimals);
+		return true;
+	}
+
+	HomiePostedValue value;
+	value.pProp=this;
+	value.type=homiePostFloat;
+	value.decimals=decimals;
+	value.fValue=fValue;
+	return pParent->pParent->PostValue(value);
+}
+
+bool HomieProperty::PostBool(bool bValue)
+{
+	if(!pParent->pParent->ringPost.IsEnabled())
+	{
+		SetBool(bValue);
+		return true;
+	}
+
+	HomiePostedValue value;
+	value.pProp=this;
+	value.type=homiePostBool;
+	value.bValue=bValue;
+	return pParent->pParent->PostValue(value);
+}
+
+bool HomieProperty::PostValue(const char * szValue)
+{
+	if(!pParent->pParent->ringPost.IsEnabled())
+	{
+		SetValue(szValue);
+		return true;
+	}
+
+	if(strlen(szValue)>=HOMIELIB_POST_STRING_MAX) return false;
+
+	HomiePostedValue value;
+	value.pProp=this;
+	value.type=homiePostString;
+	strcpy(value.szValue,szValue);
+	return pParent->pParent->PostValue(value);
+}
+
 
-bool HomieProperty::ValidateFormat_Int(int & min, int & max)
+bool HomieProperty::ValidateFormat_Int(int32_t & min, int32_t & max)
 {
 	int colon=strFormat.indexOf(':');
 
 	if(colon>0)
 	{
-		min=atoi(strFormat.substring(0, colon).c_str());
-		max=atoi(strFormat.substring(colon+1).c_str());
-		return true;
+		const char * szFormat=strFormat.c_str();
+		return HomieParseInt(szFormat,colon,min) && HomieParseInt(szFormat+colon+1,strFormat.length()-colon-1,max);
 	}
 
 	return false;
@@ -301,47 +580,77 @@ bool HomieProperty::ValidateFormat_Double(double & min, double & max)
 
 	if(colon>0)
 	{
-		min=atof(strFormat.substring(0, colon).c_str());
-		max=atof(strFormat.substring(colon+1).c_str());
-		return true;
+		const char * szFormat=strFormat.c_str();
+		return HomieParseFloat(szFormat,colon,min) && HomieParseFloat(szFormat+colon+1,strFormat.length()-colon-1,max);
 	}
 
 	return false;
 }
 
 
-bool HomieProperty::SetValueConstrained(const String & strNewValue)
+static bool HomieSameString(const String & a, const String & b)
+{
+	return a.length()==b.length() && !memcmp(a.c_str(),b.c_str(),a.length());
+}
+
+bool HomieProperty::SetValueConstrained(const String & strNewValue, bool & bChanged)
 {
+	bChanged=true;
+
 	switch((eHomieDataType) datatype)
 	{
 	default:
-		strValue=strNewValue;
+		bChanged=!HomieSameString(strValue,strNewValue);
+		if(bChanged) strValue=strNewValue;
 		return true;
 	case homieInt:
 		{
 
-			int newvalue=atoi(strNewValue.c_str());
+			int32_t newvalue=0;
+
+			if(strNewValue.length() && !HomieParseInt(strNewValue.c_str(),strNewValue.length(),newvalue))
+			{
+#ifdef HOMIELIB_VERBOSE
+				csprintf("%s ignoring invalid payload %s (not an integer)\n",strFriendlyName.c_str(),strNewValue.c_str());
+#endif
+				return false;
+			}
 
-			int min,max;
+			int32_t min,max;
 
 			if(ValidateFormat_Int(min,max))
 			{
 				if(newvalue<min || newvalue>max)
 				{
 #ifdef HOMIELIB_VERBOSE
-					csprintf("%s ignoring invalid payload %s (int out of range %i:%i)\n",strFriendlyName.c_str(),strNewValue.c_str(),min,max);
+					csprintf("%s ignoring invalid payload %s (int out of range %i:%i)\n",strFriendlyName.c_str(),strNewValue.c_str(),(int) min,(int) max);
 #endif
 					return false;
 				}
 			}
 
-			strValue=String(newvalue);
+			int32_t oldvalue;
+			bChanged=!HomieParseInt(strValue.c_str(),strValue.length(),oldvalue) || oldvalue!=newvalue;
+			if(bChanged)
+			{
+				char szTemp[16];
+				HomieFormatInt(szTemp,sizeof(szTemp),newvalue);
+				strValue=szTemp;
+			}
 			return true;
 		}
 		break;
 	case homieFloat:
 		{
-			double newvalue=atof(strNewValue.c_str());
+			double newvalue=0;
+
+			if(strNewValue.length() && !HomieParseFloat(strNewValue.c_str(),strNewValue.length(),newvalue))
+			{
+#ifdef HOMIELIB_VERBOSE
+				csprintf("%s ignoring invalid payload %s (not a number)\n",strFriendlyName.c_str(),strNewValue.c_str());
+#endif
+				return false;
+			}
 
 			double min,max;
 
@@ -356,11 +665,26 @@ bool HomieProperty::SetValueConstrained(const String & strNewValue)
 				}
 			}
 
-			strValue=strNewValue/*String(newvalue)*/;
+			char szTemp[32];
+			if(decimals>=0 && strNewValue.length() && HomieFormatFloat(szTemp,sizeof(szTemp),newvalue,decimals)>0)
+			{
+				//compare what would be published, 21.04 and 21.03 are both "21.0"
+				bChanged=strValue!=szTemp;
+				if(bChanged) strValue=szTemp;
+				return true;
+			}
+
+			double oldvalue;
+			bChanged=!HomieParseFloat(strValue.c_str(),strValue.length(),oldvalue) || oldvalue!=newvalue;
+			if(bChanged)
+			{
+				strValue=strNewValue/*String(newvalue)*/;
+			}
 			return true;
 		}
 	case homieBool:
-		if(strNewValue=="true") strValue="true"; else if(strNewValue=="false") strValue="false";
+		if(strNewValue=="true") { bChanged=strValue!="true"; strValue="true"; }
+		else if(strNewValue=="false") { bChanged=strValue!="false"; strValue="false"; }
 		else
 		{
 #ifdef HOMIELIB_VERBOSE
@@ -393,7 +717,8 @@ bool HomieProperty::SetValueConstrained(const String & strNewValue)
 
 			if(bValid)
 			{
-				strValue=strNewValue;
+				bChanged=!HomieSameString(strValue,strNewValue);
+				if(bChanged) strValue=strNewValue;
 				return true;
 			}
 			else
@@ -407,8 +732,24 @@ bool HomieProperty::SetValueConstrained(const String & strNewValue)
 
 		break;
 	case homieColor:
-		strValue=strNewValue;
-		return true;
+		{
+			uint32_t rgb=0;
+			bool bValid=true;
+			if(strFormat=="rgb") bValid=HomieParseRGB(strNewValue.c_str(),rgb);
+			else if(strFormat=="hsv") bValid=HomieParseHSV(strNewValue.c_str(),rgb);
+
+			if(!bValid)
+			{
+#ifdef HOMIELIB_VERBOSE
+				csprintf("%s ignoring invalid payload %s (not a %s color)\n",strFriendlyName.c_str(),strNewValue.c_str(),strFormat.c_str());
+#endif
+				return false;
+			}
+
+			bChanged=!HomieSameString(strValue,strNewValue);
+			if(bChanged) strValue=strNewValue;
+			return true;
+		}
 		break;
 	};
 
@@ -439,14 +780,32 @@ void HomieProperty::OnMqttMessage(char* topic, byte* payload, void * properties,
 		std::string temp;
 		temp.assign((const char *) payload,len);
 
-		bool bValid=SetValueConstrained(String(temp.c_str()));
+		bool bChanged;
+		bool bValid=SetValueConstrained(String(temp.c_str()),bChanged);
 		//pProp->strValue.
+		if(bValid && bChanged)
+		{
+			pParent->SetJsonDirty();
+		}
+
+		if(bValid && !bChanged && GetSuppressUnchanged())
+		{
+			bValid=false;	//nothing new, skip the callback and the echo
+		}
+
+		bool bBaseTopic=GetRetained() && !strcmp(topic,GetTopic().c_str()) && !GetIsStandardMQTT();
+
+		if(bValid && !bBaseTopic && CoalesceSet())
+		{
+			return;	//the latest value is delivered from Loop
+		}
+
 		if(bValid)
 		{
 			DoCallback();
 		}
 
-		if(GetRetained() && !strcmp(topic,GetTopic().c_str()) && !GetIsStandardMQTT())
+		if(bBaseTopic)
 		{
 #ifdef HOMIELIB_VERBOSE
 			csprintf("%s received initial value for base topic %s. Unsubscribing.\n",strFriendlyName.c_str(),GetTopic().c_str());
@@ -486,6 +845,20 @@ String HomieProperty::GetTopic()
 	return pParent->GetTopic()+"/"+strID;
 }
 
+bool HomieProperty::GetTopic(char * szTopic, size_t size)
+{
+	int len;
+	if(GetIsStandardMQTT())
+	{
+		len=snprintf(szTopic,size,"%s",strID.c_str());
+	}
+	else
+	{
+		len=snprintf(szTopic,size,"%s/%s/%s",pParent->pParent->strTopic.c_str(),pParent->strID.c_str(),strID.c_str());
+	}
+	return len>=0 && (size_t) len<size;
+}
+
 String HomieProperty::GetSetTopic()
 {
 	if(GetIsStandardMQTT()) return strID;
@@ -514,11 +887,140 @@ String HomieNode::GetTopic()
 	return pParent->strTopic+"/"+strID;
 }
 
-void HomieNode::PublishDefaults()
+void HomieNode::SetJsonPublishing(bool bEnable, unsigned long ulInterval_ms, const char * szTopic)
+{
+	bJson=bEnable;
+	bJsonDirty=bEnable;
+	ulJsonInterval_ms=ulInterval_ms;
+	strJsonTopic=szTopic;
+}
+
+void HomieNode::SetJsonDirty()
+{
+	bJsonDirty=true;
+	if(bJson) pParent->Wake();
+}
+
+static void HomieJsonAppendString(String & strJson, const char * szValue)
+{
+	strJson+='"';
+	while(*szValue)
+	{
+		char c=*szValue++;
+		if(c=='"' || c=='\\')
+		{
+			strJson+='\\';
+			strJson+=c;
+		}
+		else if((unsigned char) c<0x20)
+		{
+			char szEscape[8];
+			snprintf(szEscape,sizeof(szEscape),"\\u%04x",c);
+			strJson+=szEscape;
+		}
+		else
+		{
+			strJson+=c;
+		}
+	}
+	strJson+='"';
+}
+
+//-?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static bool HomieIsJsonNumber(const char * sz)
+{
+	if(*sz=='-') sz++;
+	if(*sz=='0') sz++;
+	else if(*sz>='1' && *sz<='9') { while(*sz>='0' && *sz<='9') sz++; }
+	else return false;
+
+	if(*sz=='.')
+	{
+		sz++;
+		if(!(*sz>='0' && *sz<='9')) return false;
+		while(*sz>='0' && *sz<='9') sz++;
+	}
+
+	if(*sz=='e' || *sz=='E')
+	{
+		sz++;
+		if(*sz=='+' || *sz=='-') sz++;
+		if(!(*sz>='0' && *sz<='9')) return false;
+		while(*sz>='0' && *sz<='9') sz++;
+	}
+
+	return !*sz;
+}
+
+void HomieNode::DoJsonPublishing()
 {
+	if(!bJson || !bJsonDirty) return;
+	if(ulJsonTimestamp && millis()-ulJsonTimestamp<ulJsonInterval_ms) return;
+
+	String strJson;
+	strJson.reserve(32+vecProperty.size()*24);
+	strJson+='{';
+
+	bool bFirst=true;
 	for(size_t a=0;a<vecProperty.size();a++)
 	{
-		vecProperty[a]->PublishDefault();
+		HomieProperty & prop=*vecProperty[a];
+		if(prop.GetIsStandardMQTT()) continue;
+
+		if(!bFirst) strJson+=',';
+		bFirst=false;
+
+		HomieJsonAppendString(strJson,prop.strID.c_str());
+		strJson+=':';
+
+		const char * szValue=prop.strValue.c_str();
+		if(!*szValue && !HomieDataTypeAllowsEmpty((eHomieDataType) prop.datatype))
+		{
+			szValue=GetDefaultForHomieDataType((eHomieDataType) prop.datatype);
+		}
+
+		switch((eHomieDataType) prop.datatype)
+		{
+		case homieInt:
+		case homieFloat:
+			{
+				double value;
+				if(!HomieParseFloat(szValue,strlen(szValue),value) || !std::isfinite(value))
+				{
+					strJson+="null";
+				}
+				else if(HomieIsJsonNumber(szValue))
+				{
+					strJson+=szValue;
+				}
+				else
+				{
+					//accepted but not JSON, like ".5", "+5" or "05"
+					char szTemp[32];
+					int length;
+					if(prop.datatype==homieInt && value>=-2147483648.0 && value<=2147483647.0 && value==(int32_t) value) length=HomieFormatInt(szTemp,sizeof(szTemp),(int32_t) value);
+					else length=HomieFormatFloat(szTemp,sizeof(szTemp),value,prop.decimals>=0?prop.decimals:6);
+					if(length>0) strJson+=szTemp;
+					else strJson+="null";
+				}
+			}
+			break;
+		case homieBool:
+			strJson+=strcmp(szValue,"true")?"false":"true";
+			break;
+		default:
+			HomieJsonAppendString(strJson,szValue);
+			break;
+		}
+	}
+
+	strJson+='}';
+
+	String strTopic=GetTopic()+"/"+strJsonTopic;
+	if(pParent->PublishDirectUint8(strTopic.c_str(), pParent->qosValues, true, (const uint8_t *) strJson.c_str(), strJson.length()))
+	{
+		bJsonDirty=false;
+		ulJsonTimestamp=millis();
 	}
 }
 
@@ -546,13 +1048,32 @@ void HomieProperty::SetRetained(bool bEnable){if(bEnable) flags |= 0x2; else fla
 void HomieProperty::SetFakeRetained(bool bEnable){if(bEnable) flags |= 0x4; else flags &= ~0x4;}
 void HomieProperty::SetPublishEmptyString(bool bEnable){if(bEnable) flags |= 0x8; else flags &= ~0x8;}
 void HomieProperty::SetInitialized(bool bEnable){if(bEnable) flags |= 0x10; else flags &= ~0x10;}
+void HomieProperty::ResetConnectionFlags() {flags &= ~(0x80 | 0x400);}	//InitialPublishingDone, NeedsPublish
 void HomieProperty::SetReceivedRetained(bool bEnable){if(bEnable) flags |= 0x20; else flags &= ~0x20;}
 void HomieProperty::SetIsStandardMQTT(bool bEnable){if(bEnable) flags |= 0x40; else flags &= ~0x40;}
 void HomieProperty::SetInitialPublishingDone(bool bEnable){if(bEnable) flags |= 0x80; else flags &= ~0x80;}
 void HomieProperty::SetDebug(bool bEnable){if(bEnable) flags |= 0x100; else flags &= ~0x100;}
 void HomieProperty::SetClearPayloadAfterCallback(bool bEnable){if(bEnable) flags |= 0x200; else flags &= ~0x200;}
-void HomieProperty::SetNeedsPublish(bool bEnable) {if(bEnable) flags |= 0x400; else flags &= ~0x400;}
+void HomieProperty::SetNeedsPublish(bool bEnable)
+{
+	if(bEnable==GetNeedsPublish()) return;
+	if(bEnable) flags |= 0x400; else flags &= ~0x400;
+
+	HomieDevice * pDevice=pParent ? pParent->pParent : NULL;
+	if(!pDevice) return;
+	pDevice->iLazyPending+=bEnable ? 1 : -1;
+	if(bEnable) pDevice->Wake();
+}
+
 void HomieProperty::SetNoPublishOnSet(bool bEnable) {if(bEnable) flags |= 0x800; else flags &= ~0x800;}
+void HomieProperty::SetQueued(bool bEnable) {if(bEnable) flags |= 0x1000; else flags &= ~0x1000;}
+void HomieProperty::SetChangedOffline(bool bEnable) {if(bEnable) flags |= 0x2000; else flags &= ~0x2000;}
+void HomieProperty::SetBatched(bool bEnable) {if(bEnable) flags |= 0x8000; else flags &= ~0x8000;}
+void HomieProperty::SetIsStream(bool bEnable) {if(bEnable) flags |= 0x10000; else flags &= ~0x10000;}
+void HomieProperty::SetSuppressUnchanged(bool bEnable) {if(bEnable) flags |= 0x4000; else flags &= ~0x4000;}
+void HomieProperty::SetPriority(bool bEnable) {if(bEnable) flags |= 0x20000; else flags &= ~0x20000;}
+void HomieProperty::SetPublishQos(int qos) {flags=(flags & ~0xC0000) | ((uint32_t) (max(-1,min(qos,2))+1) << 18);}	//stored +1, 0 is the device default
+void HomieProperty::SetSubscribeQos(int qos) {flags=(flags & ~0x300000) | ((uint32_t) (max(-1,min(qos,2))+1) << 20);}
 
 
 
@@ -568,5 +1089,27 @@ bool HomieProperty::GetDebug(){return (flags & 0x100)!=0;}
 bool HomieProperty::GetClearPayloadAfterCallback(){return (flags & 0x200)!=0;}
 bool HomieProperty::GetNeedsPublish(){return (flags & 0x400)!=0;}
 bool HomieProperty::GetNoPublishOnSet(){return (flags & 0x800)!=0;}
+bool HomieProperty::GetQueued(){return (flags & 0x1000)!=0;}
+bool HomieProperty::GetChangedOffline(){return (flags & 0x2000)!=0;}
+bool HomieProperty::GetBatched(){return (flags & 0x8000)!=0;}
+bool HomieProperty::GetIsStream(){return (flags & 0x10000)!=0;}
+bool HomieProperty::GetSuppressUnchanged(){return (flags & 0x4000)!=0;}
+bool HomieProperty::GetPriority(){return (flags & 0x20000)!=0;}
+
+uint8_t HomieProperty::GetPublishQos()
+{
+	int qos=((flags >> 18) & 3)-1;
+	return qos>=0 ? qos : pParent->pParent->qosValues;
+}
+
+uint8_t HomieProperty::GetSubscribeQos()
+{
+	int qos=((flags >> 20) & 3)-1;
+	if(qos<0) qos=pParent->pParent->qosSubscriptions;
+#if defined(USE_PUBSUBCLIENT)
+	if(qos>1) qos=1;	//PubSubClient subscribes at 0 or 1 only
+#endif
+	return qos;
+}
 
 
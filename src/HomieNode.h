@@ -3,14 +3,62 @@
 
 #include <functional>
 #include <vector>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 #include "Config.h"
 
 class HomieProperty;
+class HomieStreamProperty;
 class HomieNode;
 class HomieDevice;
 
 typedef std::function<void(HomieProperty * pSource)> HomiePropertyCallback;
+typedef void (*HomiePropertyCallbackFn)(HomieProperty * pSource, void * pContext);
+
+//holds one callable inline, without heap allocation, as long as it fits in HOMIELIB_CALLBACK_INLINE_SIZE.
+class HomieCallbackSlot
+{
+public:
+	HomieCallbackSlot() {}
+	~HomieCallbackSlot() { if(pDestroy) pDestroy(storage); }
+
+	HomieCallbackSlot(const HomieCallbackSlot &)=delete;
+	HomieCallbackSlot & operator=(const HomieCallbackSlot &)=delete;
+
+	bool IsSet() { return pInvoke!=NULL; }
+
+	template<class F> bool Set(F && fn)	//false if it doesn't fit
+	{
+		typedef typename std::decay<F>::type T;
+		return SetInline<T>(std::forward<F>(fn), std::integral_constant<bool, sizeof(T)<=HOMIELIB_CALLBACK_INLINE_SIZE && alignof(T)<=alignof(void *)>());
+	}
+
+	bool Set(HomiePropertyCallbackFn fn, void * pContext)
+	{
+		return Set([fn, pContext](HomieProperty * pSource) { fn(pSource,pContext); });
+	}
+
+	void Invoke(HomieProperty * pSource) { pInvoke(storage,pSource); }
+
+private:
+	template<class T, class F> bool SetInline(F &&, std::false_type) { return false; }
+
+	template<class T, class F> bool SetInline(F && fn, std::true_type)
+	{
+		if(pInvoke) return false;
+
+		new (storage) T(std::forward<F>(fn));
+		pInvoke=[](void * p, HomieProperty * pSource) { (*(T *) p)(pSource); };
+		if(!std::is_trivially_destructible<T>::value) pDestroy=[](void * p) { ((T *) p)->~T(); };
+		return true;
+	}
+
+	void (*pInvoke)(void * p, HomieProperty * pSource)=NULL;
+	void (*pDestroy)(void * p)=NULL;
+	alignas(void *) unsigned char storage[HOMIELIB_CALLBACK_INLINE_SIZE];
+};
 
 enum eHomieDataType
 {
@@ -38,6 +86,24 @@ struct AsyncMqttClientMessageProperties;
 #elif defined(USE_PUBSUBCLIENT)
 #endif
 
+struct HomiePublishLimit
+{
+	unsigned long ulMinInterval_ms=0;
+	unsigned long ulMaxInterval_ms=0;
+	double dDeadband=0;
+	bool bDeadbandRelative=false;
+
+	bool bPending=false;
+	bool bPublished=false;
+	unsigned long ulLastPublish=0;
+	double dLastPublished=0;
+
+	unsigned long ulCoalesceWindow_ms=0;
+	bool bCoalesce=false;
+	bool bCoalescePending=false;
+	unsigned long ulLastDelivery=0;
+};
+
 class HomieProperty
 {
 public:
@@ -62,6 +128,16 @@ public:
 	void SetDebug(bool bEnable);
 	void SetClearPayloadAfterCallback(bool bEnable);
 	void SetNoPublishOnSet(bool bEnable);
+	void SetSuppressUnchanged(bool bEnable);	//skip publish and callback when a value equal to the current one is set or received
+	void SetPriority(bool bEnable);	//value and /set subscription go out first after a connect. call before init
+	void SetPublishQos(int qos);	//override HomieDevice::qosValues for this property. -1 goes back to the default
+	void SetSubscribeQos(int qos);	//override HomieDevice::qosSubscriptions for this property. -1 goes back to the default
+
+	//publish rate control. call before init.
+	void SetMinPublishInterval(unsigned long ulInterval_ms);	//changes within the interval are held back and the latest one published when it expires
+	void SetMaxPublishInterval(unsigned long ulInterval_ms);	//republish the current value at least this often
+	void SetDeadband(double dDeadband, bool bRelative=false);	//homieInt/homieFloat: skip changes smaller than this. relative is a fraction of the last published value
+	void SetCoalesceSet(bool bEnable, unsigned long ulWindow_ms=0);	//rapid /set commands only deliver the latest value once per window. 0 delivers at the next Loop
 
 	bool GetSettable();
 	bool GetRetained();
@@ -71,6 +147,10 @@ public:
 	bool GetDebug();
 	bool GetClearPayloadAfterCallback();
 	bool GetNoPublishOnSet();
+	bool GetSuppressUnchanged();
+	bool GetPriority();
+	uint8_t GetPublishQos();
+	uint8_t GetSubscribeQos();
 
 //	bool bSettable=false;
 //	bool bRetained=true;
@@ -84,6 +164,20 @@ public:
 	const String & GetValue();
 	void SetValue(const String & strNewValue);
 	void SetBool(bool bValue);
+	void SetInt(int32_t iValue);
+	void SetFloat(double fValue, int decimals=-1);	//-1 uses the property's decimals, or 2 if unset
+
+	//homieColor with strFormat "rgb" or "hsv": packed 0xRRGGBB, decoded from the value on each call
+	uint32_t GetColorRGB();
+	void SetColorRGB(uint32_t rgb);
+	void SetColorHSV(uint32_t hsv);	//packed with HomiePackHSV, written as is to an "hsv" property
+
+	//with HomieDevice::iPostQueueSize set, safe to call from any task: the value is queued and applied (and published) by Loop.
+	//without the queue they just call Set*, so like those they may only be called from the task running Loop
+	bool PostInt(int32_t iValue);
+	bool PostFloat(float fValue, int8_t decimals=-1);
+	bool PostBool(bool bValue);
+	bool PostValue(const char * szValue);
 
 #if defined(HOMIELIB_VIRTUAL_ONCALLBACK)
 	virtual void OnCallback() {};
@@ -91,6 +185,11 @@ public:
 
 	void DoCallback();
 	void AddCallback(HomiePropertyCallback cb);
+	void AddCallback(HomiePropertyCallbackFn fn, void * pContext);
+	template<class F> void AddCallback(F fn)
+	{
+		if(!callback.Set(fn)) AddCallback(HomiePropertyCallback(fn));
+	}
 
 	bool Publish();
 
@@ -110,11 +209,14 @@ public:
 
 	String GetTopic();
 	String GetSetTopic();
+	bool GetTopic(char * szTopic, size_t size);	//no allocation. false if it doesn't fit
 
 	bool GetReceivedRetained();
 
 protected:
 	void SetReceivedRetained(bool bEnable);
+	void SetIsStream(bool bEnable);
+	bool GetIsStream();
 	HomieNode * pParent=NULL;
 
 private:
@@ -122,7 +224,9 @@ private:
 //	String strTopic;
 	//String strSetTopic;
 	String * pstrUnit=NULL;
+	HomiePublishLimit * pLimit=NULL;
 	String strValue;
+	HomieCallbackSlot callback;	//the first callback lives here, any further ones in pVecCallback
 	std::vector<HomiePropertyCallback> * pVecCallback=NULL;
 
 
@@ -130,9 +234,9 @@ private:
 	friend class HomieDevice;
 	friend class HomieNode;
 
-	bool SetValueConstrained(const String & strNewValue);
+	bool SetValueConstrained(const String & strNewValue, bool & bChanged);
 
-	bool ValidateFormat_Int(int & min, int & max);
+	bool ValidateFormat_Int(int32_t & min, int32_t & max);
 	bool ValidateFormat_Double(double & min, double & max);
 
 	void PublishDefault();
@@ -147,13 +251,31 @@ private:
 	bool GetInitialized();
 	bool GetIsStandardMQTT();
 
+	void ResetConnectionFlags();
 	void SetNeedsPublish(bool bEnable);
 	bool GetNeedsPublish();
 
+	void SetQueued(bool bEnable);
+	bool GetQueued();
+
+	void SetChangedOffline(bool bEnable);
+	bool GetChangedOffline();
+
+	void SetBatched(bool bEnable);
+	bool GetBatched();
+
+	uint16_t SendValue();
+
+	HomiePublishLimit * GetLimit();
+	bool LimitAllowsPublish();
+	bool CoalesceSet();
+	void DoLimits();
+
 public:
 	uint8_t datatype=homieString;	/* eHomieDataType */
+	int8_t decimals=-1;	//homieFloat: values are stored and published with this many decimals. -1 keeps them as given
 private:
-	uint16_t flags=0;
+	uint32_t flags=0;
 
 };
 
@@ -175,17 +297,28 @@ public:
 
 	String GetTopic();
 
+	//additionally publish all property values as one retained JSON object to <node topic>/<szTopic>,
+	//at most once per interval. the individual property topics are published as usual.
+	void SetJsonPublishing(bool bEnable, unsigned long ulInterval_ms=1000, const char * szTopic="$json");
+
 private:
 
 	void Init();
 
+	bool bJson=false;
+	bool bJsonDirty=false;
+	unsigned long ulJsonInterval_ms=0;
+	unsigned long ulJsonTimestamp=0;
+	String strJsonTopic;
+
+	void SetJsonDirty();
+	void DoJsonPublishing();
+
 	friend class HomieDevice;
 	friend class HomieProperty;
 	HomieDevice * pParent;
 //	String strTopic;
 
-	void PublishDefaults();
-
 };
 
 
@@ -0,0 +1,185 @@
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#ifndef HOMIELIB_FORCE_INLINE
+#define HOMIELIB_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+//single producer / single consumer ring. the producer (transport task) fills a slot in place
+//and commits it, the consumer (Loop) reads the front slot in place and pops it. no locks.
+//the producer side is forced inline and touches no out of line code, so an IRAM_ATTR ISR can push.
+
+template<class T>
+class HomieSpscRing
+{
+public:
+
+	static const int iMaxSize=65534;	//indices are 16 bit and one slot stays empty
+
+	int Init(int iSize)	//returns the capacity, sizes above iMaxSize are clamped
+	{
+		if(iSize>iMaxSize) iSize=iMaxSize;
+		vecSlot.resize(iSize>0?iSize+1:0);
+		pSlot=vecSlot.size()?&vecSlot[0]:NULL;
+		uSize=vecSlot.size();
+		uHead.store(0);
+		uTail.store(0);
+		return iSize>0?iSize:0;
+	}
+
+	bool IsEnabled() { return uSize!=0; }
+
+	HOMIELIB_FORCE_INLINE T * BeginPush()	//producer side, NULL if full
+	{
+		if(!uSize) return NULL;
+		uint16_t head=uHead.load(std::memory_order_relaxed);
+		if(Next(head)==uTail.load(std::memory_order_acquire)) return NULL;
+		return &pSlot[head];
+	}
+
+	HOMIELIB_FORCE_INLINE void CommitPush()
+	{
+		uHead.store(Next(uHead.load(std::memory_order_relaxed)),std::memory_order_release);
+	}
+
+	T * Front()	//consumer side, NULL if empty
+	{
+		uint16_t tail=uTail.load(std::memory_order_relaxed);
+		if(tail==uHead.load(std::memory_order_acquire)) return NULL;
+		return &pSlot[tail];
+	}
+
+	void Pop()
+	{
+		uTail.store(Next(uTail.load(std::memory_order_relaxed)),std::memory_order_release);
+	}
+
+	T * FrontSpan(int & count)	//consumer side, the longest run of queued slots that is contiguous in memory
+	{
+		uint16_t tail=uTail.load(std::memory_order_relaxed);
+		uint16_t head=uHead.load(std::memory_order_acquire);
+		count=head>=tail?head-tail:uSize-tail;
+		return count?&pSlot[tail]:NULL;
+	}
+
+	void Pop(int count)
+	{
+		uTail.store((uTail.load(std::memory_order_relaxed)+count) % uSize,std::memory_order_release);
+	}
+
+	int Count()
+	{
+		int count=(int) uHead.load(std::memory_order_acquire)-(int) uTail.load(std::memory_order_acquire);
+		if(count<0) count+=uSize;
+		return count;
+	}
+
+private:
+
+	HOMIELIB_FORCE_INLINE uint16_t Next(uint16_t index) { return index+1==uSize?0:index+1; }
+
+	std::vector<T> vecSlot;
+	T * pSlot=NULL;		//vecSlot's storage, the push path must not call into std::vector
+	uint16_t uSize=0;
+	std::atomic<uint16_t> uHead{0};
+	std::atomic<uint16_t> uTail{0};
+
+};
+
+
+//bounded multi producer / single consumer ring (per-slot sequence numbers, Vyukov style).
+//any task may push without blocking, a full ring simply refuses. only one task may pop.
+
+template<class T>
+class HomieMpscRing
+{
+public:
+
+	~HomieMpscRing()
+	{
+		delete [] pCell;
+	}
+
+	void Init(int iSize)
+	{
+		delete [] pCell;
+		pCell=NULL;
+		uMask=0;
+		if(iSize<=0) return;
+
+		uint32_t size=1;
+		while((int) size<iSize) size<<=1;
+
+		pCell=new Cell[size];
+		uMask=size-1;
+		for(uint32_t i=0;i<size;i++) pCell[i].seq.store(i,std::memory_order_relaxed);
+		uEnqueue.store(0);
+		uDequeue=0;
+	}
+
+	bool IsEnabled() { return pCell!=NULL; }
+
+	T * BeginPush(uint32_t & pos)	//producer side, NULL if full
+	{
+		if(!pCell) return NULL;
+		pos=uEnqueue.load(std::memory_order_relaxed);
+		while(1)
+		{
+			Cell & cell=pCell[pos & uMask];
+			int32_t diff=(int32_t) (cell.seq.load(std::memory_order_acquire)-pos);
+			if(diff==0)
+			{
+				if(uEnqueue.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)) return &cell.data;
+			}
+			else if(diff<0)
+			{
+				return NULL;
+			}
+			else
+			{
+				pos=uEnqueue.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void CommitPush(uint32_t pos)
+	{
+		pCell[pos & uMask].seq.store(pos+1,std::memory_order_release);
+	}
+
+	T * Front()	//consumer side, NULL if empty
+	{
+		if(!pCell) return NULL;
+		Cell & cell=pCell[uDequeue & uMask];
+		if(cell.seq.load(std::memory_order_acquire)!=uDequeue+1) return NULL;
+		return &cell.data;
+	}
+
+	void Pop()
+	{
+		pCell[uDequeue & uMask].seq.store(uDequeue+uMask+1,std::memory_order_release);
+		uDequeue++;
+	}
+
+	int Count()
+	{
+		return (int) (uEnqueue.load(std::memory_order_acquire)-uDequeue);
+	}
+
+private:
+
+	struct Cell
+	{
+		std::atomic<uint32_t> seq;
+		T data;
+	};
+
+	Cell * pCell=NULL;
+	uint32_t uMask=0;
+	std::atomic<uint32_t> uEnqueue{0};
+	uint32_t uDequeue=0;
+
+};
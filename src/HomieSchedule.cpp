@@ -0,0 +1,47 @@
+#include "HomieSchedule.h"
+
+uint32_t HomieBackoff_ms(uint32_t attempt, uint32_t min_ms, uint32_t max_ms)
+{
+	uint32_t interval=min_ms;
+	for(uint32_t i=1;i<attempt && interval<max_ms;i++)
+	{
+		if(interval>0x7FFFFFFF) return max_ms;
+		interval*=2;
+	}
+	if(interval>max_ms) interval=max_ms;
+	return interval;
+}
+
+uint32_t HomieJitter_ms(uint32_t interval_ms, uint32_t random)
+{
+	//randomized so a fleet doesn't retry in lockstep
+	return interval_ms/2+random % (interval_ms/2+1);
+}
+
+uint32_t HomieLossSpread_ms(uint32_t min_ms, uint32_t random)
+{
+	//so a broker restart isn't hit by every device at once
+	if(min_ms==0xFFFFFFFF) return random;
+	return random % (min_ms+1);
+}
+
+uint32_t HomieHash(const char * sz, uint32_t hash)
+{
+	while(*sz)
+	{
+		hash^=(uint8_t) *sz++;
+		hash*=16777619UL;
+	}
+	return hash;
+}
+
+uint32_t HomiePhaseSeed(const char * szID, const char * szMac)
+{
+	return HomieHash(szID,HomieHash(szMac));
+}
+
+uint32_t HomiePhaseOffset(uint32_t seed, uint32_t spread)
+{
+	if(!spread) return 0;
+	return seed % spread;
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+//reconnect and phase timing as pure functions. the caller supplies the random values, so a fleet can be simulated on the host
+
+uint32_t HomieBackoff_ms(uint32_t attempt, uint32_t min_ms, uint32_t max_ms);	//doubles from min_ms on each attempt after the first, up to max_ms
+uint32_t HomieJitter_ms(uint32_t interval_ms, uint32_t random);	//between half and all of interval_ms
+uint32_t HomieLossSpread_ms(uint32_t min_ms, uint32_t random);	//delay of the first attempt after a lost connection, 0 to min_ms
+
+uint32_t HomieHash(const char * sz, uint32_t hash=2166136261UL);	//FNV-1a
+uint32_t HomiePhaseSeed(const char * szID, const char * szMac);	//same on every boot, different from device to device
+uint32_t HomiePhaseOffset(uint32_t seed, uint32_t spread);	//this device's place in 0 to spread-1, 0 without a spread
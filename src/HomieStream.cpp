@@ -0,0 +1,84 @@
+#include "HomieStream.h"
+#include "HomieDevice.h"
+#include "HomieFormat.h"
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+HomieStreamProperty::HomieStreamProperty(int iBufferSamples)
+{
+	ring.Init(iBufferSamples);
+	SetRetained(false);
+	SetIsStream(true);
+}
+
+bool IRAM_ATTR HomieStreamProperty::AddSample(int16_t sample)
+{
+	int16_t * pSlot=ring.BeginPush();
+	if(!pSlot)
+	{
+		ulOverflows++;
+		return false;
+	}
+
+	*pSlot=sample;
+	ring.CommitPush();
+	return true;
+}
+
+bool HomieStreamProperty::DoStream()
+{
+	if(!GetInitialPublishingDone()) return true;
+
+	int iWaiting=ring.Count();
+	if(!iWaiting) return true;
+
+	bool bTimeout=millis()-ulLastBatch>=ulBatchInterval_ms;
+
+	//full batches right away, the remainder once it has waited long enough
+	while(iWaiting>=iBatchSamples || (bTimeout && iWaiting>0))
+	{
+		int iPublished=PublishBatch();
+		if(!iPublished) return false;
+		iWaiting-=iPublished;
+		ulLastBatch=millis();
+	}
+
+	return true;
+}
+
+int HomieStreamProperty::PublishBatch()
+{
+	int count;
+	int16_t * pSamples=ring.FrontSpan(count);
+	if(!pSamples) return 0;
+
+	if(count>iBatchSamples) count=iBatchSamples;
+
+	char szTopic[128];
+	if(!GetTopic(szTopic,sizeof(szTopic))) return 0;
+
+	HomieDevice * pDevice=GetParentNode()->GetParentDevice();
+	uint8_t qos=GetPublishQos();
+	size_t iMaxPayload=pDevice->GetMaxPayload(strlen(szTopic),qos);	//a batch the transport can't buffer would be refused forever
+
+	if(format==homieStreamBinary)
+	{
+		if(count*sizeof(int16_t)>iMaxPayload) count=iMaxPayload/sizeof(int16_t);
+
+		//straight from the ring to the transport
+		if(!count || !pDevice->PublishDirectUint8(szTopic, qos, false, (const uint8_t *) pSamples, count*sizeof(int16_t))) return 0;
+	}
+	else
+	{
+		char szCSV[HOMIELIB_STREAM_CSV_MAX];
+		int length;
+		count=HomieFormatSamplesCsv(szCSV,min(sizeof(szCSV),iMaxPayload+1),pSamples,count,length);
+
+		if(!count || !pDevice->PublishDirectUint8(szTopic, qos, false, (const uint8_t *) szCSV, length)) return 0;
+	}
+
+	ring.Pop(count);
+	return count;
+}
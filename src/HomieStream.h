@@ -0,0 +1,41 @@
+#pragma once
+#include "HomieNode.h"
+#include "HomieQueue.h"
+
+#ifndef HOMIELIB_STREAM_CSV_MAX
+#define HOMIELIB_STREAM_CSV_MAX 512
+#endif
+
+enum eHomieStreamFormat
+{
+	homieStreamBinary,	//raw little endian int16 samples
+	homieStreamCSV,		//comma separated decimal samples
+};
+
+//a property for high rate sample data. samples go into a preallocated ring from a task or an ISR
+//and are published as non-retained batches from Loop. it is announced in $properties like any other property.
+class HomieStreamProperty : public HomieProperty
+{
+public:
+	HomieStreamProperty(int iBufferSamples=256);
+
+	uint8_t format=homieStreamBinary;	/* eHomieStreamFormat */
+	int iBatchSamples=64;				//publish as soon as this many samples are waiting
+	unsigned long ulBatchInterval_ms=1000;	//or when samples have been waiting this long
+
+	bool AddSample(int16_t sample);		//single producer. false if the ring is full
+
+	int GetSamplesWaiting() { return ring.Count(); }
+	uint32_t GetOverflows() { return ulOverflows; }
+
+private:
+	friend class HomieDevice;
+
+	bool DoStream();	//false if the transport refused a batch
+	int PublishBatch();	//number of samples published
+
+	HomieSpscRing<int16_t> ring;
+	std::atomic<uint32_t> ulOverflows{0};
+	unsigned long ulLastBatch=0;
+
+};
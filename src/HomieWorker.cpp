@@ -0,0 +1,166 @@
+#include "HomieWorker.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+void HomieWorker::TaskMain(void * parameter)
+{
+	HomieWorker * pWorker=(HomieWorker *) parameter;
+
+	while(1)
+	{
+		ulTaskNotifyTake(pdTRUE,portMAX_DELAY);	//sleep until signaled, several signals wake us once
+
+		if(pWorker->bQuit) break;
+
+		pWorker->fn(pWorker->pContext);
+	}
+
+	pWorker->bRunning=false;
+	vTaskDelete(NULL);
+}
+
+bool HomieWorker::Start(const char * szName, int iStackSize, HomieWorkerFn fn, void * pContext)
+{
+	if(hTask) return true;
+
+	this->fn=fn;
+	this->pContext=pContext;
+	bQuit=false;
+	bRunning=true;
+
+	if(xTaskCreate(TaskMain, szName, iStackSize, this, 1, &hTask)!=pdPASS)
+	{
+		hTask=NULL;
+		bRunning=false;
+		return false;
+	}
+	return true;
+}
+
+void HomieWorker::Signal()
+{
+	if(hTask) xTaskNotifyGive(hTask);
+}
+
+void HomieWorker::Stop()
+{
+	if(!hTask) return;
+
+	bQuit=true;
+	xTaskNotifyGive(hTask);
+	while(bRunning) vTaskDelay(1);
+	hTask=NULL;
+}
+
+bool HomieWorker::IsRunning()
+{
+	return hTask!=NULL;
+}
+
+uint32_t HomieWorker::GetStackFree()
+{
+	return hTask ? uxTaskGetStackHighWaterMark(hTask) : 0;
+}
+
+#elif !defined(ARDUINO)
+
+void HomieWorker::ThreadMain()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while(1)
+	{
+		cv.wait(lock,[this] { return bSignaled || bQuit; });
+
+		if(bQuit) break;
+
+		bSignaled=false;
+		lock.unlock();
+		fn(pContext);
+		lock.lock();
+	}
+}
+
+bool HomieWorker::Start(const char * szName, int iStackSize, HomieWorkerFn fn, void * pContext)
+{
+	(void)(szName);
+	(void)(iStackSize);
+
+	if(thread.joinable()) return true;
+
+	this->fn=fn;
+	this->pContext=pContext;
+	bQuit=false;
+	bSignaled=false;
+
+	try
+	{
+		thread=std::thread(&HomieWorker::ThreadMain,this);
+	}
+	catch(const std::system_error &)
+	{
+		return false;
+	}
+	return true;
+}
+
+void HomieWorker::Signal()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bSignaled=true;
+	}
+	cv.notify_one();
+}
+
+void HomieWorker::Stop()
+{
+	if(!thread.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bQuit=true;
+	}
+	cv.notify_one();
+	thread.join();
+}
+
+bool HomieWorker::IsRunning()
+{
+	return thread.joinable();
+}
+
+uint32_t HomieWorker::GetStackFree()
+{
+	return 0;
+}
+
+#else
+
+bool HomieWorker::Start(const char * szName, int iStackSize, HomieWorkerFn fn, void * pContext)
+{
+	(void)(szName);
+	(void)(iStackSize);
+	(void)(fn);
+	(void)(pContext);
+	return false;
+}
+
+void HomieWorker::Signal()
+{
+}
+
+void HomieWorker::Stop()
+{
+}
+
+bool HomieWorker::IsRunning()
+{
+	return false;
+}
+
+uint32_t HomieWorker::GetStackFree()
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include "Arduino.h"
+#elif !defined(ARDUINO)
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+//runs a function on its own task whenever it's signaled. a FreeRTOS task notification on ESP32, a thread and a condition variable on the host.
+//signals that arrive while the function runs fold into one more run. other platforms have no tasks, there Start always fails
+class HomieWorker
+{
+public:
+	typedef void (*HomieWorkerFn)(void * pContext);
+
+	~HomieWorker() { Stop(); }
+
+	bool Start(const char * szName, int iStackSize, HomieWorkerFn fn, void * pContext);	//false if the task couldn't be created. true if it's already running
+	void Signal();
+	void Stop();	//waits for a run in progress to finish
+	bool IsRunning();
+	uint32_t GetStackFree();	//least free stack seen, in bytes. 0 where that isn't known
+
+private:
+	HomieWorkerFn fn=0;
+	void * pContext=0;
+
+#if defined(ARDUINO_ARCH_ESP32)
+	static void TaskMain(void * parameter);
+	TaskHandle_t hTask=NULL;
+	volatile bool bQuit=false;
+	volatile bool bRunning=false;
+#elif !defined(ARDUINO)
+	void ThreadMain();
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool bSignaled=false;
+	bool bQuit=false;
+#endif
+};
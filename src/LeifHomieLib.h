@@ -2,3 +2,7 @@
 #include "Config.h"
 #include "HomieDevice.h"
 #include "HomieNode.h"
+#include "HomieStream.h"
+#include "HomieFormat.h"
+#include "HomieColor.h"
+#include "HomieSchedule.h"
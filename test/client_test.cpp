@@ -0,0 +1,151 @@
+//HomieCoalescingClient over a loopback socket: socket writes per coalescing phase, and everything arrives in order.
+//built against test/host/WiFi.h instead of the Arduino one
+
+#include "HomieClient.h"
+#include <cstdio>
+#include <string>
+#include <thread>
+
+static int iFailures=0;
+
+#define CHECK(x) do { if(!(x)) { printf("FAIL %s:%i %s\n",__FILE__,__LINE__,#x); iFailures++; } } while(0)
+
+static const size_t iPacketSize=40;	//about a small publish
+static const char szAck[]="ACK!";
+
+//accepts one connection and reads until it's closed. with bAck every packet is answered like a PUBACK
+class Server
+{
+public:
+	Server()
+	{
+		fdListen=socket(AF_INET,SOCK_STREAM,0);
+		sockaddr_in addr={};
+		addr.sin_family=AF_INET;
+		addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+		bind(fdListen,(sockaddr *) &addr,sizeof(addr));
+		listen(fdListen,1);
+		socklen_t len=sizeof(addr);
+		getsockname(fdListen,(sockaddr *) &addr,&len);
+		uPort=ntohs(addr.sin_port);
+	}
+	~Server() { close(fdListen); }
+
+	void Start(bool bAck)
+	{
+		strReceived.clear();
+		thread=std::thread([this,bAck]()
+				{
+					int fd=accept(fdListen,NULL,NULL);
+					char buf[4096];
+					size_t iUnacked=0;
+					ssize_t ret;
+					while((ret=recv(fd,buf,sizeof(buf),0))>0)
+					{
+						strReceived.append(buf,ret);
+						for(iUnacked+=ret;bAck && iUnacked>=iPacketSize;iUnacked-=iPacketSize) send(fd,szAck,4,MSG_NOSIGNAL);
+					}
+					close(fd);
+				});
+	}
+	std::string Finish() { thread.join(); return strReceived; }
+
+	uint16_t uPort;
+
+private:
+	int fdListen;
+	std::thread thread;
+	std::string strReceived;
+};
+
+static std::string Packet(int index)
+{
+	std::string packet(iPacketSize,0);
+	for(size_t i=0;i<iPacketSize;i++) packet[i]=(char) (index*7+i);
+	return packet;
+}
+
+struct Phase
+{
+	int iBufferSize;
+	int iPackets;
+	bool bWaitForAck;	//what ArduinoMQTT does for QoS 1/2
+	size_t iLargeWrite;	//a write bigger than the buffer at the end, 0 for none
+};
+
+static uint32_t RunPhase(Server & server, const Phase & phase)
+{
+	WiFiClient net;
+	HomieCoalescingClient client(net);
+	client.SetBufferSize(phase.iBufferSize);
+
+	server.Start(phase.bWaitForAck);
+	CHECK(client.connect(IPAddress(127,0,0,1),server.uPort));
+	uint32_t ulConnectSends=net.ulSends;
+
+	std::string strSent;
+	client.BeginCoalesce();
+	for(int i=0;i<phase.iPackets;i++)
+	{
+		std::string packet=Packet(i);
+		CHECK(client.write((const uint8_t *) packet.data(),packet.size())==packet.size());
+		strSent+=packet;
+
+		if(phase.bWaitForAck)
+		{
+			while(client.available()<4) usleep(100);
+			char ack[4];
+			CHECK(client.read((uint8_t *) ack,4)==4 && !memcmp(ack,szAck,4));
+		}
+	}
+	if(phase.iLargeWrite)
+	{
+		std::string large(phase.iLargeWrite,'x');
+		CHECK(client.write((const uint8_t *) large.data(),large.size())==large.size());
+		strSent+=large;
+	}
+	CHECK(client.EndCoalesce());
+	uint32_t ulSends=net.ulSends-ulConnectSends;
+
+	CHECK(client.GetWrites()==ulSends);
+	CHECK(client.GetBytes()==strSent.size());
+	CHECK(client.GetFlushFailures()==0);
+
+	client.stop();
+	CHECK(server.Finish()==strSent);
+	return ulSends;
+}
+
+int main()
+{
+	Server server;
+
+	CHECK(RunPhase(server,{1400,20,false,0})==1);	//a bulk publishing pass at QoS 0 goes out in one segment
+	CHECK(RunPhase(server,{0,20,false,0})==20);	//without coalescing every publish is a write
+	CHECK(RunPhase(server,{1400,100,false,0})==3);	//35 packets fit the buffer
+	CHECK(RunPhase(server,{1400,5,false,2000})==2);	//what's buffered, then the large write straight through
+	CHECK(RunPhase(server,{1400,10,true,0})==10);	//waiting for each ack flushes each publish on its own
+
+	//nested phases flush when the outermost one ends
+	{
+		WiFiClient net;
+		HomieCoalescingClient client(net);
+		client.SetBufferSize(1400);
+		server.Start(false);
+		CHECK(client.connect(IPAddress(127,0,0,1),server.uPort));
+		std::string packet=Packet(1);
+		client.BeginCoalesce();
+		client.BeginCoalesce();
+		client.write((const uint8_t *) packet.data(),packet.size());
+		CHECK(client.EndCoalesce());
+		CHECK(net.ulSends==0);
+		client.write((const uint8_t *) packet.data(),packet.size());
+		CHECK(client.EndCoalesce());
+		CHECK(net.ulSends==1);
+		client.stop();
+		CHECK(server.Finish()==packet+packet);
+	}
+
+	printf("client_test: %s\n",iFailures?"FAILED":"ok");
+	return iFailures?1:0;
+}
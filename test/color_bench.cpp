@@ -0,0 +1,117 @@
+//microbenchmark of the fixed point color code against the sscanf and float versions the library used before
+
+#include "HomieColor.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <random>
+
+static const int iRounds=2000000;
+
+static volatile uint32_t ulSink;	//keeps the optimizer from dropping the work
+
+template<class F>
+static void Bench(const char * szName, F f, int iPerRound=1)
+{
+	auto start=std::chrono::steady_clock::now();
+	for(int i=0;i<iRounds;i++) f(i);
+	double ns=std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-start).count()/iRounds/iPerRound;
+	printf("  %-28s %7.1f ns\n",szName,ns);
+}
+
+//the previous implementation, verbatim
+static void HSVtoRGB(float fHueIn, float fSatIn, float fBriteIn, float & fRedOut, float & fGreenOut, float & fBlueOut)
+{
+	float fHue = (float) fmod(fHueIn / 6.0f, 60);
+	float fC = fBriteIn * fSatIn;
+	float fL = fBriteIn - fC;
+	float fX = (float) (fC * (1.0f - fabs(fmod(fHue * 0.1f, 2.0f) - 1.0f)));
+
+	if(fHue >= 0.0f && fHue < 10.0f) { fRedOut = fC; fGreenOut = fX; fBlueOut = 0; }
+	else if(fHue >= 10.0f && fHue < 20.0f) { fRedOut = fX; fGreenOut = fC; fBlueOut = 0; }
+	else if(fHue >= 20.0f && fHue < 30.0f) { fRedOut = 0; fGreenOut = fC; fBlueOut = fX; }
+	else if(fHue >= 30.0f && fHue < 40.0f) { fRedOut = 0; fGreenOut = fX; fBlueOut = fC; }
+	else if(fHue >= 40.0f && fHue < 50.0f) { fRedOut = fX; fGreenOut = 0; fBlueOut = fC; }
+	else if(fHue >= 50.0f && fHue < 60.0f) { fRedOut = fC; fGreenOut = 0; fBlueOut = fX; }
+	else { fRedOut = 0; fGreenOut = 0; fBlueOut = 0; }
+
+	fRedOut += fL;
+	fGreenOut += fL;
+	fBlueOut += fL;
+}
+
+static uint32_t FloatToRGB(float h, float s, float v)
+{
+	float fR, fG, fB;
+	HSVtoRGB(h, s, v, fR, fG, fB);
+
+	int r=fR*256.0f;
+	int g=fG*256.0f;
+	int b=fB*256.0f;
+
+	if(r>255) r=255;
+	if(g>255) g=255;
+	if(b>255) b=255;
+
+	return (r<<16) + (g<<8) + (b<<0);
+}
+
+static bool OldParseHSV(const char * in, uint32_t & rgb)
+{
+	float h, s, v;
+
+	if(sscanf(in, "%f,%f,%f", &h, &s, &v) == 3)
+	{
+		rgb=FloatToRGB(h, s*0.01f, v*0.01f);
+		return true;
+	}
+	return false;
+}
+
+static bool OldParseRGB(const char * in, uint32_t & rgb)
+{
+	int r, g, b;
+
+	if(sscanf(in, "%d,%d,%d", &r, &g, &b) == 3)
+	{
+		rgb=(r<<16) + (g<<8) + (b<<0);
+		return true;
+	}
+	return false;
+}
+
+int main()
+{
+	std::mt19937 rng(7);
+	std::vector<uint32_t> vecHSV(1024), vecRGB(1024);
+	std::vector<float> vecH(1024), vecS(1024), vecV(1024);
+	std::vector<std::string> vecHSVText, vecRGBText;
+	for(size_t i=0;i<vecHSV.size();i++)
+	{
+		vecHSV[i]=rng();
+		vecH[i]=(vecHSV[i]>>16)*360.0f/65536.0f;
+		vecS[i]=((vecHSV[i]>>8) & 0xFF)/255.0f;
+		vecV[i]=(vecHSV[i] & 0xFF)/255.0f;
+
+		char sz[32];
+		snprintf(sz,sizeof(sz),"%.1f,%.1f,%.1f",vecH[i],vecS[i]*100.0f,vecV[i]*100.0f);
+		vecHSVText.push_back(sz);
+		snprintf(sz,sizeof(sz),"%u,%u,%u",(unsigned) (rng() & 0xFF),(unsigned) (rng() & 0xFF),(unsigned) (rng() & 0xFF));
+		vecRGBText.push_back(sz);
+	}
+
+	printf("hsv to rgb, per pixel\n");
+	Bench("HomieHSVtoRGB x1",[&](int i) { uint32_t rgb; HomieHSVtoRGB(&vecHSV[i & 1023],&rgb,1); ulSink=rgb; });
+	Bench("HomieHSVtoRGB x256",[&](int i) { HomieHSVtoRGB(&vecHSV[(i & 3)*256],&vecRGB[0],256); ulSink=vecRGB[i & 255]; },256);
+	Bench("float HSVtoRGB",[&](int i) { ulSink=FloatToRGB(vecH[i & 1023],vecS[i & 1023],vecV[i & 1023]); });
+
+	printf("text to color\n");
+	Bench("HomieParseHSV",[&](int i) { uint32_t rgb=0; HomieParseHSV(vecHSVText[i & 1023].c_str(),rgb); ulSink=rgb; });
+	Bench("sscanf %f + float HSVtoRGB",[&](int i) { uint32_t rgb=0; OldParseHSV(vecHSVText[i & 1023].c_str(),rgb); ulSink=rgb; });
+	Bench("HomieParseRGB",[&](int i) { uint32_t rgb=0; HomieParseRGB(vecRGBText[i & 1023].c_str(),rgb); ulSink=rgb; });
+	Bench("sscanf %d",[&](int i) { uint32_t rgb=0; OldParseRGB(vecRGBText[i & 1023].c_str(),rgb); ulSink=rgb; });
+
+	return 0;
+}
@@ -0,0 +1,228 @@
+//edge cases for the HomieColor parsers and the fixed point HSV conversion
+
+#include "HomieColor.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+static int iFailures=0;
+
+#define CHECK(x) do { if(!(x)) { printf("FAIL %s:%i %s\n",__FILE__,__LINE__,#x); iFailures++; } } while(0)
+
+static bool ParsesRGB(const char * in, uint32_t expected)
+{
+	uint32_t rgb=~expected;
+	return HomieParseRGB(in,rgb) && rgb==expected;
+}
+
+static bool RejectsRGB(const char * in)
+{
+	uint32_t rgb=0x123456;
+	return !HomieParseRGB(in,rgb) && rgb==0x123456;
+}
+
+static bool ParsesHSV(const char * in, uint32_t expected)
+{
+	uint32_t rgb=~expected;
+	if(!HomieParseHSV(in,rgb)) return false;
+	if(rgb!=expected) printf("  \"%s\" gave %06x, expected %06x\n",in,rgb,expected);
+	return rgb==expected;
+}
+
+static bool RejectsHSV(const char * in)
+{
+	uint32_t rgb=0x123456;
+	return !HomieParseHSV(in,rgb) && rgb==0x123456;
+}
+
+static int ChannelDistance(uint32_t a, uint32_t b)
+{
+	int worst=0;
+	for(int shift=0;shift<24;shift+=8)
+	{
+		int d=abs((int) ((a>>shift) & 0xFF)-(int) ((b>>shift) & 0xFF));
+		if(d>worst) worst=d;
+	}
+	return worst;
+}
+
+static void TestRGB()
+{
+	CHECK(ParsesRGB("0,0,0",0x000000));
+	CHECK(ParsesRGB("255,255,255",0xFFFFFF));
+	CHECK(ParsesRGB("18,52,86",0x123456));
+	CHECK(ParsesRGB(" 1 , 2 , 3 ",0x010203));
+	CHECK(ParsesRGB("007,0,0",0x070000));
+
+	CHECK(RejectsRGB("256,0,0"));
+	CHECK(RejectsRGB("0,256,0"));
+	CHECK(RejectsRGB("0,0,256"));
+	CHECK(RejectsRGB("-1,0,0"));
+	CHECK(RejectsRGB("9999999,0,0"));
+	CHECK(RejectsRGB("1.5,0,0"));	//the spec has no fractions for rgb
+	CHECK(RejectsRGB("1,2,3.0"));
+	CHECK(RejectsRGB("1,2,3,"));
+	CHECK(RejectsRGB("1,2,3,4"));
+	CHECK(RejectsRGB("1,2"));
+	CHECK(RejectsRGB("1,,3"));
+	CHECK(RejectsRGB(""));
+	CHECK(RejectsRGB("a,b,c"));
+	CHECK(RejectsRGB("1,2,3x"));
+}
+
+static void TestHSV()
+{
+	CHECK(ParsesHSV("0,100,100",0xFF0000));
+	CHECK(ParsesHSV("120,100,100",0x00FF00));
+	CHECK(ParsesHSV("240,100,100",0x0000FF));
+	CHECK(ParsesHSV("360,100,100",0xFF0000));	//a full circle wraps to red
+	CHECK(ParsesHSV("0,0,100",0xFFFFFF));
+	CHECK(ParsesHSV("0,0,0",0x000000));
+	CHECK(ParsesHSV("60,100,100.0",0xFFFF00));
+	CHECK(ParsesHSV("180.5,100,100",0x00FDFF));
+	CHECK(ParsesHSV("0,0,50.25",0x808080));	//extra decimals are dropped
+
+	CHECK(RejectsHSV("361,0,0"));
+	CHECK(RejectsHSV("360.1,0,0"));
+	CHECK(RejectsHSV("0,101,0"));
+	CHECK(RejectsHSV("0,0,100.1"));
+	CHECK(RejectsHSV("-1,0,0"));
+	CHECK(RejectsHSV("0,0,.5"));
+	CHECK(RejectsHSV("1,2,3,"));
+	CHECK(RejectsHSV("1,2"));
+	CHECK(RejectsHSV(""));
+}
+
+static bool FormatsRGB(uint32_t rgb, const char * szExpected)
+{
+	char sz[16];
+	int length=HomieFormatRGB(sz,sizeof(sz),rgb);
+	return length==(int) strlen(szExpected) && !strcmp(sz,szExpected);
+}
+
+static bool FormatsHSV(uint32_t hsv, const char * szExpected)
+{
+	char sz[24];
+	int length=HomieFormatHSV(sz,sizeof(sz),hsv);
+	if(length!=(int) strlen(szExpected) || strcmp(sz,szExpected))
+	{
+		printf("  %08x gave \"%s\", expected \"%s\"\n",hsv,length>=0?sz:"",szExpected);
+		return false;
+	}
+	return true;
+}
+
+static void TestFormat()
+{
+	CHECK(FormatsRGB(0x000000,"0,0,0"));
+	CHECK(FormatsRGB(0xFFFFFF,"255,255,255"));
+	CHECK(FormatsRGB(0x123456,"18,52,86"));
+	CHECK(FormatsHSV(HomiePackHSV(0,0,0),"0,0,0"));
+	CHECK(FormatsHSV(HomiePackHSV(0,255,255),"0,100,100"));
+	CHECK(FormatsHSV(HomiePackHSV(32768,128,64),"180,50.2,25.1"));
+	CHECK(FormatsHSV(HomiePackHSV(65535,255,255),"360,100,100"));
+
+	//too small buffers fail instead of truncating
+	char sz[12];
+	CHECK(HomieFormatRGB(sz,11,0xFFFFFF)==-1);
+	CHECK(HomieFormatRGB(sz,12,0xFFFFFF)==11);
+	CHECK(HomieFormatRGB(sz,0,0)==-1);
+	CHECK(HomieFormatHSV(sz,6,0)==5);
+	CHECK(HomieFormatHSV(sz,5,0)==-1);
+	CHECK(HomieFormatHSV(sz,6,HomiePackHSV(0,0,1))==-1);
+
+	//what's formatted parses back: saturation and value exactly, hue to a tenth of a degree
+	uint32_t rgb;
+	for(uint32_t sv=0;sv<0x10000;sv++)
+	{
+		uint32_t hsv=HomiePackHSV(0,sv>>8,sv & 0xFF), expected;
+		HomieFormatHSV(sz,sizeof(sz),hsv);
+		HomieHSVtoRGB(&hsv,&expected,1);
+		CHECK(HomieParseHSV(sz,rgb) && rgb==expected);
+	}
+	for(uint32_t h=0;h<0x10000;h+=7)
+	{
+		uint32_t hsv=HomiePackHSV(h,255,255), expected;
+		char szHSV[24];
+		HomieFormatHSV(szHSV,sizeof(szHSV),hsv);
+		HomieHSVtoRGB(&hsv,&expected,1);
+		CHECK(HomieParseHSV(szHSV,rgb) && ChannelDistance(rgb,expected)<=1);
+	}
+	for(uint32_t i=0;i<0x1000000;i+=0x010307)
+	{
+		CHECK(HomieFormatRGB(sz,sizeof(sz),i)>0 && HomieParseRGB(sz,rgb) && rgb==i);
+	}
+}
+
+static void TestRoundTrip()
+{
+	//every rgb color through hsv and back, off by at most one step per channel
+	int worst=0;
+	for(uint32_t rgb=0;rgb<0x1000000;rgb++)
+	{
+		uint32_t hsv=HomieRGBtoHSV(rgb);
+		uint32_t back;
+		HomieHSVtoRGB(&hsv,&back,1);
+		int d=ChannelDistance(rgb,back);
+		if(d>worst) worst=d;
+	}
+	CHECK(worst<=1);
+
+	//grays and primaries come back exactly
+	for(uint32_t v=0;v<256;v++)
+	{
+		uint32_t hsv[4]={HomieRGBtoHSV(v*0x010101),HomieRGBtoHSV(v<<16),HomieRGBtoHSV(v<<8),HomieRGBtoHSV(v)};
+		uint32_t rgb[4];
+		HomieHSVtoRGB(hsv,rgb,4);
+		CHECK(rgb[0]==v*0x010101);
+		CHECK(rgb[1]==v<<16);
+		CHECK(rgb[2]==v<<8);
+		CHECK(rgb[3]==v);
+	}
+}
+
+static void TestAgainstFloat()
+{
+	//the batch kernel against a straight float conversion, for arrays of any length
+	std::mt19937 rng(5);
+	uint32_t hsv[37], rgb[37];
+	int worst=0;
+	for(int round=0;round<10000;round++)
+	{
+		for(int i=0;i<37;i++) hsv[i]=rng();
+		HomieHSVtoRGB(hsv,rgb,37);
+		for(int i=0;i<37;i++)
+		{
+			double h=(hsv[i]>>16)/65536.0*6.0, s=((hsv[i]>>8) & 0xFF)/255.0, v=(hsv[i] & 0xFF)/255.0;
+			double c=v*s, x=c*(1.0-fabs(fmod(h,2.0)-1.0)), m=v-c;
+			double r=0, g=0, b=0;
+			switch((int) h)
+			{
+			case 0: r=c; g=x; break;
+			case 1: r=x; g=c; break;
+			case 2: g=c; b=x; break;
+			case 3: g=x; b=c; break;
+			case 4: r=x; b=c; break;
+			default: r=c; b=x; break;
+			}
+			uint32_t expected=((uint32_t) lround((r+m)*255)<<16) | ((uint32_t) lround((g+m)*255)<<8) | (uint32_t) lround((b+m)*255);
+			int d=ChannelDistance(rgb[i],expected);
+			if(d>worst) worst=d;
+		}
+	}
+	CHECK(worst<=2);	//two roundings in 8 bit, at most one step each
+}
+
+int main()
+{
+	TestRGB();
+	TestHSV();
+	TestFormat();
+	TestRoundTrip();
+	TestAgainstFloat();
+
+	printf("color_test: %s\n",iFailures?"FAILED":"ok");
+	return iFailures?1:0;
+}
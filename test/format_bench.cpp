@@ -0,0 +1,67 @@
+//microbenchmark of the HomieFormat conversions against the libc calls the library used before.
+//String(int) and String(float,n) are itoa and dtostrf/snprintf underneath, so those stand in for them
+
+#include "HomieFormat.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+
+static const int iRounds=2000000;
+
+static volatile int iSink;	//keeps the optimizer from dropping the work
+
+template<class F>
+static void Bench(const char * szName, F f)
+{
+	auto start=std::chrono::steady_clock::now();
+	for(int i=0;i<iRounds;i++) f(i);
+	double ns=std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-start).count()/iRounds;
+	printf("  %-28s %7.1f ns\n",szName,ns);
+}
+
+int main()
+{
+	std::mt19937 rng(3);
+	std::vector<int32_t> vecInt(1024);
+	std::vector<double> vecFloat(1024);
+	for(size_t i=0;i<vecInt.size();i++)
+	{
+		vecInt[i]=(int32_t) rng()>>(rng() % 24);
+		vecFloat[i]=(double) (int32_t) rng()/(1<<(rng() % 20));
+	}
+
+	std::vector<std::string> vecIntText,vecFloatText;
+	for(size_t i=0;i<vecInt.size();i++)
+	{
+		char sz[32];
+		snprintf(sz,sizeof(sz),"%i",vecInt[i]);
+		vecIntText.push_back(sz);
+		snprintf(sz,sizeof(sz),"%.2f",vecFloat[i]);
+		vecFloatText.push_back(sz);
+	}
+
+	char sz[48];
+
+	printf("int to text\n");
+	Bench("HomieFormatInt",[&](int i) { iSink=HomieFormatInt(sz,sizeof(sz),vecInt[i & 1023]); });
+	Bench("snprintf %i",[&](int i) { iSink=snprintf(sz,sizeof(sz),"%i",vecInt[i & 1023]); });
+	Bench("std::to_string",[&](int i) { iSink=std::to_string(vecInt[i & 1023]).length(); });
+
+	printf("float to text, 2 decimals\n");
+	Bench("HomieFormatFloat",[&](int i) { iSink=HomieFormatFloat(sz,sizeof(sz),vecFloat[i & 1023],2); });
+	Bench("snprintf %.2f",[&](int i) { iSink=snprintf(sz,sizeof(sz),"%.2f",vecFloat[i & 1023]); });
+
+	printf("text to int\n");
+	Bench("HomieParseInt",[&](int i) { const std::string & s=vecIntText[i & 1023]; int32_t v; HomieParseInt(s.c_str(),s.length(),v); iSink=v; });
+	Bench("atoi",[&](int i) { iSink=atoi(vecIntText[i & 1023].c_str()); });
+
+	printf("text to float\n");
+	Bench("HomieParseFloat",[&](int i) { const std::string & s=vecFloatText[i & 1023]; double v; HomieParseFloat(s.c_str(),s.length(),v); iSink=(int) v; });
+	Bench("atof",[&](int i) { iSink=(int) atof(vecFloatText[i & 1023].c_str()); });
+
+	return 0;
+}
@@ -0,0 +1,224 @@
+//edge cases for the HomieFormat number conversions: overflow, rounding, signs and syntax
+
+#include "HomieFormat.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <random>
+
+static int iFailures=0;
+
+#define CHECK(x) do { if(!(x)) { printf("FAIL %s:%i %s\n",__FILE__,__LINE__,#x); iFailures++; } } while(0)
+
+static bool FormatsInt(int32_t value, const char * szExpected)
+{
+	char sz[16];
+	int length=HomieFormatInt(sz,sizeof(sz),value);
+	return length==(int) strlen(szExpected) && !strcmp(sz,szExpected);
+}
+
+static bool FormatsFloat(double value, int decimals, const char * szExpected)
+{
+	char sz[48];
+	int length=HomieFormatFloat(sz,sizeof(sz),value,decimals);
+	if(length!=(int) strlen(szExpected) || strcmp(sz,szExpected))
+	{
+		printf("  %.17g/%i gave \"%s\" (%i), expected \"%s\"\n",value,decimals,length>=0?sz:"",length,szExpected);
+		return false;
+	}
+	return true;
+}
+
+static bool ParsesInt(const char * in, int32_t expected)
+{
+	int32_t value=~expected;
+	return HomieParseInt(in,strlen(in),value) && value==expected;
+}
+
+static bool RejectsInt(const char * in)
+{
+	int32_t value;
+	return !HomieParseInt(in,strlen(in),value);
+}
+
+static bool ParsesFloat(const char * in, double expected)
+{
+	double value;
+	return HomieParseFloat(in,strlen(in),value) && value==expected;
+}
+
+static bool RejectsFloat(const char * in)
+{
+	double value;
+	return !HomieParseFloat(in,strlen(in),value);
+}
+
+static void TestFormatInt()
+{
+	CHECK(FormatsInt(0,"0"));
+	CHECK(FormatsInt(7,"7"));
+	CHECK(FormatsInt(-7,"-7"));
+	CHECK(FormatsInt(INT32_MAX,"2147483647"));
+	CHECK(FormatsInt(INT32_MIN,"-2147483648"));
+
+	char sz[4];
+	CHECK(HomieFormatInt(sz,sizeof(sz),999)==3);	//exactly fits with the terminator
+	CHECK(HomieFormatInt(sz,sizeof(sz),1000)==-1);
+	CHECK(HomieFormatInt(sz,sizeof(sz),-100)==-1);
+}
+
+static void TestFormatFloat()
+{
+	CHECK(FormatsFloat(0,2,"0.00"));
+	CHECK(FormatsFloat(1.5,0,"2"));			//half rounds away from zero
+	CHECK(FormatsFloat(-1.5,0,"-2"));
+	CHECK(FormatsFloat(0.125,2,"0.13"));
+	CHECK(FormatsFloat(-0.125,2,"-0.13"));
+	CHECK(FormatsFloat(9.995,2,"9.99"));	//9.99499.. in binary, rounds like printf
+	CHECK(FormatsFloat(9.996,2,"10.00"));	//carry into a new digit
+	CHECK(FormatsFloat(-0.001,2,"0.00"));	//no "-0.00"
+	CHECK(FormatsFloat(0.05,1,"0.1"));
+	CHECK(FormatsFloat(123.456,-1,"123"));	//decimals clamped to 0-9
+	CHECK(FormatsFloat(0.1234567891,12,"0.123456789"));
+	CHECK(FormatsFloat(1e20,1,"100000000000000000000.0"));	//beyond the integer path
+	CHECK(FormatsFloat(-1e20,0,"-100000000000000000000"));
+
+	char sz[8];
+	CHECK(HomieFormatFloat(sz,sizeof(sz),NAN,2)==-1);
+	CHECK(HomieFormatFloat(sz,sizeof(sz),INFINITY,2)==-1);
+	CHECK(HomieFormatFloat(sz,sizeof(sz),1234.5,2)==7);		//"1234.50" exactly fits
+	CHECK(HomieFormatFloat(sz,sizeof(sz),12345.5,2)==-1);
+	CHECK(HomieFormatFloat(sz,sizeof(sz),-234.5,2)==7);
+	CHECK(HomieFormatFloat(sz,sizeof(sz),-1234.5,2)==-1);
+
+	//agrees with printf wherever the value isn't a tie in decimal
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> dist(-1e6,1e6);
+	int iMismatch=0;
+	for(int i=0;i<100000;i++)
+	{
+		double value=dist(rng);
+		int decimals=i % 7;
+		char szOurs[48],szPrintf[48];
+		HomieFormatFloat(szOurs,sizeof(szOurs),value,decimals);
+		snprintf(szPrintf,sizeof(szPrintf),"%.*f",decimals,value);
+		if(strcmp(szOurs,szPrintf) && strcmp(szPrintf+(szPrintf[0]=='-'),"0")) iMismatch++;
+	}
+	CHECK(iMismatch==0);
+}
+
+static void TestParseInt()
+{
+	CHECK(ParsesInt("0",0));
+	CHECK(ParsesInt("-0",0));
+	CHECK(ParsesInt("+5",5));
+	CHECK(ParsesInt("007",7));
+	CHECK(ParsesInt("2147483647",INT32_MAX));
+	CHECK(ParsesInt("-2147483648",INT32_MIN));
+	CHECK(RejectsInt("2147483648"));
+	CHECK(RejectsInt("-2147483649"));
+	CHECK(RejectsInt("99999999999"));
+	CHECK(RejectsInt("4294967296"));	//would wrap to 0 in 32 bits
+	CHECK(RejectsInt(""));
+	CHECK(RejectsInt("-"));
+	CHECK(RejectsInt("+"));
+	CHECK(RejectsInt(" 1"));
+	CHECK(RejectsInt("1 "));
+	CHECK(RejectsInt("1a"));
+	CHECK(RejectsInt("1.0"));
+	CHECK(RejectsInt("--1"));
+
+	int32_t value;
+	CHECK(HomieParseInt("123456",3,value) && value==123);	//only the given length
+}
+
+static void TestParseFloat()
+{
+	CHECK(ParsesFloat("0",0));
+	CHECK(ParsesFloat("1.5",1.5));
+	CHECK(ParsesFloat("-0.25",-0.25));
+	CHECK(ParsesFloat("+2",2));
+	CHECK(ParsesFloat(".5",0.5));
+	CHECK(ParsesFloat("5.",5));
+	CHECK(ParsesFloat("1e3",1000));
+	CHECK(ParsesFloat("1E-2",0.01));
+	CHECK(ParsesFloat("-2.5e+1",-25));
+	CHECK(RejectsFloat(""));
+	CHECK(RejectsFloat("-"));
+	CHECK(RejectsFloat("."));
+	CHECK(RejectsFloat("e5"));
+	CHECK(RejectsFloat("1e"));
+	CHECK(RejectsFloat("1e+"));
+	CHECK(RejectsFloat("1e400"));
+	CHECK(RejectsFloat("1.2.3"));
+	CHECK(RejectsFloat("1,5"));
+	CHECK(RejectsFloat("inf"));
+	CHECK(RejectsFloat("nan"));
+	CHECK(RejectsFloat(" 1"));
+
+	//long mantissas are cut at double precision, not overflowed
+	double value;
+	CHECK(HomieParseFloat("123456789012345678901234567890",30,value) && fabs(value/1.2345678901234568e29-1)<1e-15);
+
+	std::mt19937 rng(2);
+	std::uniform_real_distribution<double> dist(-1e6,1e6);
+	int iMismatch=0;
+	for(int i=0;i<100000;i++)
+	{
+		char sz[48];
+		snprintf(sz,sizeof(sz),"%.*f",i % 7,dist(rng));
+		double ours;
+		if(!HomieParseFloat(sz,strlen(sz),ours) || fabs(ours-strtod(sz,NULL))>fabs(ours)*1e-15) iMismatch++;
+	}
+	CHECK(iMismatch==0);
+}
+
+static void TestSamplesCsv()
+{
+	int16_t samples[64];
+	for(int i=0;i<64;i++) samples[i]=(i & 1)?-32768:12345;	//5 digits and more, 64 of them don't fit 256 bytes
+
+	char sz[512];
+	int length;
+	CHECK(HomieFormatSamplesCsv(sz,sizeof(sz),samples,64,length)==64);
+	CHECK(length==32*5+32*6+63 && (int) strlen(sz)==length);
+
+	//limited like a 256 byte transport buffer, every sample that fits and nothing cut in half
+	size_t size=256-5-2-20+1;
+	int count=HomieFormatSamplesCsv(sz,size,samples,64,length);
+	CHECK(count>0 && count<64);
+	CHECK((size_t) length<size && (int) strlen(sz)==length);
+	int iNext=(count & 1)?6:5;
+	CHECK((size_t) (length+1+iNext)>=size);
+
+	const char * p=sz;
+	int iParsed=0;
+	while(*p)
+	{
+		const char * end=strchr(p,',');
+		if(!end) end=p+strlen(p);
+		int32_t value;
+		CHECK(HomieParseInt(p,end-p,value) && value==samples[iParsed]);
+		iParsed++;
+		p=*end?end+1:end;
+	}
+	CHECK(iParsed==count);
+
+	CHECK(HomieFormatSamplesCsv(sz,6,samples,64,length)==1 && length==5);
+	CHECK(HomieFormatSamplesCsv(sz,5,samples,64,length)==0 && length==0 && !sz[0]);
+	CHECK(HomieFormatSamplesCsv(sz,0,samples,64,length)==0);
+}
+
+int main()
+{
+	TestFormatInt();
+	TestFormatFloat();
+	TestParseInt();
+	TestParseFloat();
+	TestSamplesCsv();
+
+	printf("format_test: %s\n",iFailures?"FAILED":"ok");
+	return iFailures?1:0;
+}
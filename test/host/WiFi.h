@@ -0,0 +1,81 @@
+#pragma once
+//just enough of the Arduino networking API to run HomieClient on the host, over POSIX sockets
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+class IPAddress
+{
+public:
+	IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : ulAddress(((uint32_t) a<<24) | ((uint32_t) b<<16) | ((uint32_t) c<<8) | d) {}
+	uint32_t ulAddress;
+};
+
+class Client
+{
+public:
+	virtual ~Client() {}
+	virtual int connect(IPAddress ip, uint16_t port)=0;
+	virtual int connect(const char * host, uint16_t port)=0;
+	virtual size_t write(uint8_t b)=0;
+	virtual size_t write(const uint8_t * buf, size_t size)=0;
+	virtual int available()=0;
+	virtual int read()=0;
+	virtual int read(uint8_t * buf, size_t size)=0;
+	virtual int peek()=0;
+	virtual void flush()=0;
+	virtual void stop()=0;
+	virtual uint8_t connected()=0;
+	virtual operator bool()=0;
+};
+
+class WiFiClient : public Client
+{
+public:
+	~WiFiClient() { stop(); }
+
+	uint32_t ulSends=0;	//send() calls, what the test counts
+
+	int connect(IPAddress ip, uint16_t port) override
+	{
+		stop();
+		fd=socket(AF_INET,SOCK_STREAM,0);
+		sockaddr_in addr={};
+		addr.sin_family=AF_INET;
+		addr.sin_port=htons(port);
+		addr.sin_addr.s_addr=htonl(ip.ulAddress);
+		if(fd<0 || ::connect(fd,(sockaddr *) &addr,sizeof(addr))) { stop(); return 0; }
+		return 1;
+	}
+	int connect(const char * host, uint16_t port) override { (void)(host); (void)(port); return 0; }
+	size_t write(uint8_t b) override { return write(&b,1); }
+	size_t write(const uint8_t * buf, size_t size) override
+	{
+		if(fd<0) return 0;
+		ssize_t ret=send(fd,buf,size,MSG_NOSIGNAL);
+		ulSends++;
+		return ret>0?ret:0;
+	}
+	int available() override
+	{
+		int count=0;
+		if(fd<0 || ioctl(fd,FIONREAD,&count)) return 0;
+		return count;
+	}
+	int read() override { uint8_t b; return read(&b,1)==1?b:-1; }
+	int read(uint8_t * buf, size_t size) override { return fd<0?-1:(int) recv(fd,buf,size,0); }
+	int peek() override { uint8_t b; return fd>=0 && recv(fd,&b,1,MSG_PEEK)==1?b:-1; }
+	void flush() override {}
+	void stop() override { if(fd>=0) close(fd); fd=-1; }
+	uint8_t connected() override { return fd>=0; }
+	operator bool() override { return fd>=0; }
+
+private:
+	int fd=-1;
+};
@@ -0,0 +1,93 @@
+//a fleet reconnecting within one second, with the $stats schedule of HomieDevice.
+//counts $stats bursts per second at the broker, with the per-device phase and without it
+
+#include "HomieSchedule.h"
+#include <cstdio>
+#include <vector>
+#include <random>
+
+static int iFailures=0;
+
+#define CHECK(x) do { if(!(x)) { printf("FAIL %s:%i %s\n",__FILE__,__LINE__,#x); iFailures++; } } while(0)
+
+static const int iDevices=1000;
+static const uint32_t ulStatsInterval_ms=30000;
+static const uint32_t ulStatsSpread_ms=30000;	//HomieDevice default
+static const uint32_t ulHorizon_ms=600000;
+static const uint32_t ulSettled_ms=60000;	//measured from here, after every device's first shifted $stats
+
+struct Result
+{
+	int iPeak=0;
+	double dMean=0;
+};
+
+static Result Simulate(uint32_t ulSpread_ms)
+{
+	std::mt19937 rng(13);
+	std::vector<int> vecPerSecond(ulHorizon_ms/1000);
+
+	for(int d=0;d<iDevices;d++)
+	{
+		char szID[16], szMac[24];
+		snprintf(szID,sizeof(szID),"sensor-%i",d);
+		uint32_t mac=rng();
+		snprintf(szMac,sizeof(szMac),"24:0A:C4:%02X:%02X:%02X",(unsigned) (mac>>16) & 0xFF,(unsigned) (mac>>8) & 0xFF,(unsigned) mac & 0xFF);
+		uint32_t seed=HomiePhaseSeed(szID,szMac);
+
+		//what DoStats does: the first $stats right after connecting, the next one shifted by the phase, then every 30s
+		uint32_t t=rng() % 1000;
+		bool bPhased=false;
+		while(t<ulHorizon_ms)
+		{
+			vecPerSecond[t/1000]++;
+			if(!bPhased) t+=HomiePhaseOffset(seed,ulSpread_ms);
+			bPhased=true;
+			t+=ulStatsInterval_ms;
+		}
+	}
+
+	Result result;
+	int iTotal=0;
+	for(uint32_t s=ulSettled_ms/1000;s<vecPerSecond.size();s++)
+	{
+		if(vecPerSecond[s]>result.iPeak) result.iPeak=vecPerSecond[s];
+		iTotal+=vecPerSecond[s];
+	}
+	result.dMean=(double) iTotal/(vecPerSecond.size()-ulSettled_ms/1000);
+	return result;
+}
+
+static void TestFunctions()
+{
+	CHECK(HomieHash("")==2166136261UL);
+	CHECK(HomieHash("a")==0xE40C292CUL);	//FNV-1a test vector
+	CHECK(HomieHash("foobar")==0xBF9CF968UL);
+	CHECK(HomiePhaseSeed("dev","24:0A:C4:00:00:01")!=HomiePhaseSeed("dev","24:0A:C4:00:00:02"));
+	CHECK(HomiePhaseSeed("dev1","24:0A:C4:00:00:01")!=HomiePhaseSeed("dev2","24:0A:C4:00:00:01"));
+	CHECK(HomiePhaseSeed("dev","24:0A:C4:00:00:01")==HomiePhaseSeed("dev","24:0A:C4:00:00:01"));
+
+	CHECK(HomiePhaseOffset(12345,0)==0);
+	CHECK(HomiePhaseOffset(12345,1)==0);
+	CHECK(HomiePhaseOffset(12345,1000)==345);
+	CHECK(HomiePhaseOffset(0xFFFFFFFF,30000)<30000);
+}
+
+int main()
+{
+	TestFunctions();
+
+	Result lockstep=Simulate(0);
+	Result phased=Simulate(ulStatsSpread_ms);
+
+	printf("  %i devices connecting within 1s, $stats every %lus\n",iDevices,(unsigned long) ulStatsInterval_ms/1000);
+	printf("  no spread:  peak %4i/s, mean %5.1f/s\n",lockstep.iPeak,lockstep.dMean);
+	printf("  phased:     peak %4i/s, mean %5.1f/s\n",phased.iPeak,phased.dMean);
+
+	CHECK(lockstep.iPeak>lockstep.dMean*10);
+	CHECK(phased.iPeak<phased.dMean*2);	//flat: no second much busier than the average
+	CHECK(phased.dMean>lockstep.dMean*0.95 && phased.dMean<lockstep.dMean*1.05);	//same load, only spread out
+
+	printf("phase_sim: %s\n",iFailures?"FAILED":"ok");
+	return iFailures?1:0;
+}
@@ -0,0 +1,102 @@
+//contention benchmark for HomieMpscRing: N producer threads post as fast as they can while one
+//consumer drains, compared with a std::mutex guarded deque doing the same
+
+#include "HomieQueue.h"
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+
+struct Posted
+{
+	void * pProp;
+	uint8_t type;
+	int32_t iValue;
+};
+
+static const uint32_t ulPerProducer=500000;
+
+template<class PUSH, class POP>
+static double Run(int iProducers, PUSH push, POP pop)
+{
+	auto start=std::chrono::steady_clock::now();
+
+	std::vector<std::thread> producers;
+	for(int p=0;p<iProducers;p++)
+	{
+		producers.emplace_back([&push]()
+		{
+			for(uint32_t i=0;i<ulPerProducer;i++)
+			{
+				while(!push(i)) std::this_thread::yield();
+			}
+		});
+	}
+
+	uint32_t received=0;
+	while(received<ulPerProducer*iProducers)
+	{
+		if(pop()) received++;
+		else std::this_thread::yield();
+	}
+
+	for(size_t i=0;i<producers.size();i++) producers[i].join();
+
+	double seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	return received/seconds/1e6;
+}
+
+int main()
+{
+	printf("producers   mpsc ring   mutex+deque   (million posts/s)\n");
+
+	for(int iProducers=1;iProducers<=8;iProducers*=2)
+	{
+		HomieMpscRing<Posted> ring;
+		ring.Init(64);
+
+		double dRing=Run(iProducers,
+			[&ring](uint32_t i)
+			{
+				uint32_t pos;
+				Posted * pPosted=ring.BeginPush(pos);
+				if(!pPosted) return false;
+				pPosted->pProp=NULL;
+				pPosted->type=0;
+				pPosted->iValue=i;
+				ring.CommitPush(pos);
+				return true;
+			},
+			[&ring]()
+			{
+				if(!ring.Front()) return false;
+				ring.Pop();
+				return true;
+			});
+
+		std::mutex mutex;
+		std::deque<Posted> deque;
+
+		double dMutex=Run(iProducers,
+			[&](uint32_t i)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if(deque.size()>=64) return false;
+				deque.push_back(Posted{NULL,0,(int32_t) i});
+				return true;
+			},
+			[&]()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if(deque.empty()) return false;
+				deque.pop_front();
+				return true;
+			});
+
+		printf("%9i   %9.2f   %11.2f\n",iProducers,dRing,dMutex);
+	}
+
+	return 0;
+}
@@ -0,0 +1,216 @@
+//stress test for the lock-free rings: producer threads and a consumer thread hammer a small ring
+//and the consumer checks every message arrives exactly once, in order and not torn
+
+#include "HomieQueue.h"
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+
+static int iFailures=0;
+
+#define CHECK(x) do { if(!(x)) { printf("FAIL %s:%i %s\n",__FILE__,__LINE__,#x); iFailures++; } } while(0)
+
+struct Message
+{
+	uint32_t seq;
+	uint32_t payload[7];	//filled from seq, a torn read shows up as a mismatch
+};
+
+static void Fill(Message & msg, uint32_t seq)
+{
+	msg.seq=seq;
+	for(int i=0;i<7;i++) msg.payload[i]=seq*2654435761u+i;
+}
+
+static bool Valid(const Message & msg)
+{
+	for(int i=0;i<7;i++) if(msg.payload[i]!=msg.seq*2654435761u+i) return false;
+	return true;
+}
+
+static void TestSpscSingleThread()
+{
+	HomieSpscRing<Message> ring;
+	CHECK(!ring.IsEnabled());
+	CHECK(ring.BeginPush()==NULL);
+
+	ring.Init(3);
+	CHECK(ring.IsEnabled());
+	CHECK(ring.Front()==NULL);
+
+	for(uint32_t i=0;i<3;i++)
+	{
+		Message * pMsg=ring.BeginPush();
+		CHECK(pMsg!=NULL);
+		if(pMsg) { Fill(*pMsg,i); ring.CommitPush(); }
+	}
+	CHECK(ring.BeginPush()==NULL);	//full
+	CHECK(ring.Count()==3);
+
+	for(uint32_t i=0;i<3;i++)
+	{
+		Message * pMsg=ring.Front();
+		CHECK(pMsg && pMsg->seq==i);
+		ring.Pop();
+	}
+	CHECK(ring.Front()==NULL);
+	CHECK(ring.Count()==0);
+}
+
+static void TestSpscLarge()
+{
+	//the indices are 16 bit, a larger ring must be clamped rather than wrap
+	HomieSpscRing<uint32_t> ring;
+	CHECK(ring.Init(65535)==HomieSpscRing<uint32_t>::iMaxSize);
+	CHECK(ring.Init(1000000)==HomieSpscRing<uint32_t>::iMaxSize);
+
+	uint32_t pushed=0;
+	uint32_t * pSlot;
+	while((pSlot=ring.BeginPush())!=NULL)
+	{
+		*pSlot=pushed++;
+		ring.CommitPush();
+	}
+	CHECK(pushed==(uint32_t) HomieSpscRing<uint32_t>::iMaxSize);
+	CHECK(ring.Count()==HomieSpscRing<uint32_t>::iMaxSize);
+
+	int iErrors=0;
+	for(uint32_t i=0;i<pushed;i++)
+	{
+		pSlot=ring.Front();
+		if(!pSlot || *pSlot!=i) iErrors++;
+		ring.Pop();
+	}
+	CHECK(iErrors==0);
+	CHECK(ring.Front()==NULL);
+}
+
+static void TestSpscThreaded(int iSize, uint32_t count, bool bSpan)
+{
+	HomieSpscRing<Message> ring;
+	ring.Init(iSize);
+
+	std::thread producer([&]()
+	{
+		for(uint32_t seq=0;seq<count;)
+		{
+			Message * pMsg=ring.BeginPush();
+			if(!pMsg) { std::this_thread::yield(); continue; }
+			Fill(*pMsg,seq++);
+			ring.CommitPush();
+		}
+	});
+
+	uint32_t expected=0;
+	int iErrors=0;
+	while(expected<count)
+	{
+		if(bSpan)
+		{
+			int n;
+			Message * pMsg=ring.FrontSpan(n);
+			if(!pMsg) { std::this_thread::yield(); continue; }
+			for(int i=0;i<n;i++)
+			{
+				if(pMsg[i].seq!=expected++ || !Valid(pMsg[i])) iErrors++;
+			}
+			ring.Pop(n);
+		}
+		else
+		{
+			Message * pMsg=ring.Front();
+			if(!pMsg) { std::this_thread::yield(); continue; }
+			if(pMsg->seq!=expected++ || !Valid(*pMsg)) iErrors++;
+			ring.Pop();
+		}
+	}
+
+	producer.join();
+	CHECK(iErrors==0);
+	CHECK(ring.Front()==NULL);
+}
+
+static void TestMpscSingleThread()
+{
+	HomieMpscRing<Message> ring;
+	uint32_t pos;
+	CHECK(!ring.IsEnabled());
+	CHECK(ring.BeginPush(pos)==NULL);
+
+	ring.Init(3);	//rounded up to 4
+	for(uint32_t i=0;i<4;i++)
+	{
+		Message * pMsg=ring.BeginPush(pos);
+		CHECK(pMsg!=NULL);
+		if(pMsg) { Fill(*pMsg,i); ring.CommitPush(pos); }
+	}
+	CHECK(ring.BeginPush(pos)==NULL);
+	CHECK(ring.Count()==4);
+
+	for(uint32_t i=0;i<4;i++)
+	{
+		Message * pMsg=ring.Front();
+		CHECK(pMsg && pMsg->seq==i);
+		ring.Pop();
+	}
+	CHECK(ring.Front()==NULL);
+}
+
+//every producer tags its messages, per producer they must arrive in order and complete
+static void TestMpscThreaded(int iProducers, int iSize, uint32_t count)
+{
+	HomieMpscRing<Message> ring;
+	ring.Init(iSize);
+
+	std::vector<std::thread> producers;
+	for(int p=0;p<iProducers;p++)
+	{
+		producers.emplace_back([&ring,p,count]()
+		{
+			for(uint32_t i=0;i<count;)
+			{
+				uint32_t pos;
+				Message * pMsg=ring.BeginPush(pos);
+				if(!pMsg) { std::this_thread::yield(); continue; }
+				Fill(*pMsg,((uint32_t) p<<24) | i++);
+				ring.CommitPush(pos);
+			}
+		});
+	}
+
+	std::vector<uint32_t> vecNext(iProducers,0);
+	uint32_t received=0;
+	int iErrors=0;
+	while(received<count*iProducers)
+	{
+		Message * pMsg=ring.Front();
+		if(!pMsg) { std::this_thread::yield(); continue; }
+		uint32_t p=pMsg->seq>>24;
+		if(p>=(uint32_t) iProducers || (pMsg->seq & 0xFFFFFF)!=vecNext[p]++ || !Valid(*pMsg)) iErrors++;
+		ring.Pop();
+		received++;
+	}
+
+	for(size_t i=0;i<producers.size();i++) producers[i].join();
+	CHECK(iErrors==0);
+	CHECK(ring.Front()==NULL);
+	CHECK(ring.Count()==0);
+}
+
+int main()
+{
+	TestSpscSingleThread();
+	TestSpscLarge();
+	TestSpscThreaded(1,200000,false);
+	TestSpscThreaded(4,1000000,false);
+	TestSpscThreaded(7,1000000,true);
+	TestSpscThreaded(64,2000000,true);
+
+	TestMpscSingleThread();
+	TestMpscThreaded(1,2,200000);
+	TestMpscThreaded(4,4,200000);
+	TestMpscThreaded(8,16,200000);
+
+	printf("queue_test: %s\n",iFailures?"FAILED":"ok");
+	return iFailures?1:0;
+}
@@ -0,0 +1,98 @@
+//a fleet losing its broker at the same moment, with the reconnect timing of HomieDevice.
+//counts connect attempts per second at the broker, with the jitter and without it
+
+#include "HomieSchedule.h"
+#include <cstdio>
+#include <vector>
+#include <random>
+
+static int iFailures=0;
+
+#define CHECK(x) do { if(!(x)) { printf("FAIL %s:%i %s\n",__FILE__,__LINE__,#x); iFailures++; } } while(0)
+
+static const int iDevices=1000;
+static const uint32_t ulMin_ms=5000;	//HomieDevice defaults
+static const uint32_t ulMax_ms=60000;
+static const uint32_t ulBrokerDown_ms=90000;	//the broker accepts connections again after this
+static const uint32_t ulHorizon_ms=ulBrokerDown_ms+2*ulMax_ms;
+
+struct Result
+{
+	int iPeak=0;	//most attempts in any one second
+	int iPeakAfterRestart=0;	//same, from the second the broker is back
+	uint32_t ulLastConnect_ms=0;
+	int iAttempts=0;
+};
+
+static Result Simulate(bool bJitter)
+{
+	std::mt19937 rng(11);
+	std::vector<int> vecPerSecond(ulHorizon_ms/1000+1);
+	Result result;
+
+	for(int d=0;d<iDevices;d++)
+	{
+		//what Loop does: the first attempt after the loss is spread, every following one backs off
+		uint32_t t=bJitter?HomieLossSpread_ms(ulMin_ms,rng()):0;
+		for(uint32_t attempt=1;;attempt++)
+		{
+			vecPerSecond[t/1000]++;
+			result.iAttempts++;
+			if(t>=ulBrokerDown_ms) break;
+
+			uint32_t interval=HomieBackoff_ms(attempt,ulMin_ms,ulMax_ms);
+			t+=bJitter?HomieJitter_ms(interval,rng()):interval;
+		}
+		if(t>result.ulLastConnect_ms) result.ulLastConnect_ms=t;
+	}
+
+	for(size_t s=0;s<vecPerSecond.size();s++)
+	{
+		if(vecPerSecond[s]>result.iPeak) result.iPeak=vecPerSecond[s];
+		if(s>=ulBrokerDown_ms/1000 && vecPerSecond[s]>result.iPeakAfterRestart) result.iPeakAfterRestart=vecPerSecond[s];
+	}
+	return result;
+}
+
+static void TestFunctions()
+{
+	CHECK(HomieBackoff_ms(0,5000,60000)==5000);
+	CHECK(HomieBackoff_ms(1,5000,60000)==5000);
+	CHECK(HomieBackoff_ms(2,5000,60000)==10000);
+	CHECK(HomieBackoff_ms(4,5000,60000)==40000);
+	CHECK(HomieBackoff_ms(5,5000,60000)==60000);
+	CHECK(HomieBackoff_ms(0xFFFFFFFF,5000,60000)==60000);
+	CHECK(HomieBackoff_ms(40,5000,0xFFFFFFFF)==0xFFFFFFFF);	//doubling doesn't wrap
+	CHECK(HomieBackoff_ms(3,0,60000)==0);
+
+	CHECK(HomieJitter_ms(10000,0)==5000);
+	CHECK(HomieJitter_ms(10000,5000)==10000);
+	CHECK(HomieJitter_ms(10000,5001)==5000);
+	CHECK(HomieJitter_ms(0,12345)==0);
+	CHECK(HomieJitter_ms(0xFFFFFFFF,0xFFFFFFFF)<=0xFFFFFFFF);
+
+	CHECK(HomieLossSpread_ms(5000,5000)==5000);
+	CHECK(HomieLossSpread_ms(5000,5001)==0);
+	CHECK(HomieLossSpread_ms(0,12345)==0);
+	CHECK(HomieLossSpread_ms(0xFFFFFFFF,12345)==12345);
+}
+
+int main()
+{
+	TestFunctions();
+
+	Result lockstep=Simulate(false);
+	Result jittered=Simulate(true);
+
+	printf("  %i devices, broker back after %lus\n",iDevices,(unsigned long) ulBrokerDown_ms/1000);
+	printf("  lockstep: %5i attempts, peak %4i/s, %4i/s after the restart, all connected after %lus\n",lockstep.iAttempts,lockstep.iPeak,lockstep.iPeakAfterRestart,(unsigned long) lockstep.ulLastConnect_ms/1000);
+	printf("  jittered: %5i attempts, peak %4i/s, %4i/s after the restart, all connected after %lus\n",jittered.iAttempts,jittered.iPeak,jittered.iPeakAfterRestart,(unsigned long) jittered.ulLastConnect_ms/1000);
+
+	CHECK(lockstep.iPeak==iDevices);
+	CHECK(jittered.iPeak*2<lockstep.iPeak);	//the first seconds, while the loss spread and the second attempts overlap
+	CHECK(jittered.iPeakAfterRestart*10<lockstep.iPeakAfterRestart);
+	CHECK(jittered.ulLastConnect_ms<=ulBrokerDown_ms+ulMax_ms);	//the jitter never delays past the cap
+
+	printf("reconnect_sim: %s\n",iFailures?"FAILED":"ok");
+	return iFailures?1:0;
+}
@@ -0,0 +1,112 @@
+//the host variant of HomieWorker: runs on signal, folds signals during a run, stops cleanly
+
+#include "HomieWorker.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+static int iFailures=0;
+
+#define CHECK(x) do { if(!(x)) { printf("FAIL %s:%i %s\n",__FILE__,__LINE__,#x); iFailures++; } } while(0)
+
+struct Job
+{
+	std::atomic<int> iRuns{0};
+	std::atomic<bool> bInside{false};
+	std::atomic<bool> bOverlap{false};
+	int iSleep_ms=0;
+};
+
+static void RunJob(void * pContext)
+{
+	Job * pJob=(Job *) pContext;
+	if(pJob->bInside.exchange(true)) pJob->bOverlap=true;
+	if(pJob->iSleep_ms) std::this_thread::sleep_for(std::chrono::milliseconds(pJob->iSleep_ms));
+	pJob->iRuns++;
+	pJob->bInside=false;
+}
+
+static bool WaitFor(const std::atomic<int> & value, int expected)
+{
+	for(int i=0;i<2000 && value<expected;i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return value>=expected;
+}
+
+static void TestSignal()
+{
+	Job job;
+	HomieWorker worker;
+	CHECK(!worker.IsRunning());
+	CHECK(worker.Start("test",4096,RunJob,&job));
+	CHECK(worker.IsRunning());
+	CHECK(worker.Start("test",4096,RunJob,&job));	//already running
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	CHECK(job.iRuns==0);	//nothing runs until signaled
+
+	for(int i=1;i<=100;i++)
+	{
+		worker.Signal();
+		CHECK(WaitFor(job.iRuns,i));
+	}
+	CHECK(job.iRuns==100);
+
+	worker.Stop();
+	CHECK(!worker.IsRunning());
+	worker.Stop();
+	CHECK(worker.GetStackFree()==0);
+}
+
+static void TestFold()
+{
+	//signals while a run is in progress make exactly one more run, never a concurrent one
+	Job job;
+	job.iSleep_ms=50;
+	HomieWorker worker;
+	CHECK(worker.Start("test",4096,RunJob,&job));
+
+	worker.Signal();
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	for(int i=0;i<10;i++) worker.Signal();
+	CHECK(WaitFor(job.iRuns,2));
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	CHECK(job.iRuns==2);
+	CHECK(!job.bOverlap);
+	worker.Stop();
+}
+
+static void TestStop()
+{
+	//Stop waits for the run in progress and the worker can be started again
+	Job job;
+	job.iSleep_ms=50;
+	HomieWorker worker;
+	CHECK(worker.Start("test",4096,RunJob,&job));
+	worker.Signal();
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	worker.Stop();
+	CHECK(job.iRuns==1);
+	CHECK(!job.bInside);
+
+	job.iSleep_ms=0;
+	CHECK(worker.Start("test",4096,RunJob,&job));
+	worker.Signal();
+	CHECK(WaitFor(job.iRuns,2));
+
+	//and the destructor stops it
+	{
+		HomieWorker temp;
+		CHECK(temp.Start("temp",4096,RunJob,&job));
+	}
+}
+
+int main()
+{
+	TestSignal();
+	TestFold();
+	TestStop();
+
+	printf("worker_test: %s\n",iFailures?"FAILED":"ok");
+	return iFailures?1:0;
+}